@@ -0,0 +1,126 @@
+/* Fixed.h
+ *
+ * A fixed-point number type for models and views.
+ *
+ * The ATmega32U4 has no FPU, so every double operation is a call into
+ * the soft-float library: RangeView used to divide in floating point
+ * on every frame, and each encoder tick was a floating point
+ * multiply-add. The values the UI deals in are all small ratios, so
+ * 16-bit fixed point does the same job with integer instructions.
+ */
+
+#ifndef FIXED_H
+#define FIXED_H
+
+/*
+ * A signed Q8.8 number: 8 integer bits and 8 fractional bits, so it
+ * holds -128 to just under 128 in steps of 1/256.
+ *
+ * Fixed supports the arithmetic and comparisons which Model, Knob and
+ * RangeView need. Addition, subtraction and multiplication saturate
+ * at the limits of the range rather than wrapping, so constrain()
+ * always sees the right side of a limit even if a change overshoots
+ * wildly.
+ *
+ * The constructor from double is constexpr, and is meant for
+ * constants in the sketch, which the compiler converts. Converting a
+ * value at run time pulls the soft-float library back in; use ratio()
+ * instead.
+ */
+class Fixed {
+   public:
+      static const int16_t ONE = 256;
+
+      constexpr Fixed() : m_raw(0) {};
+      constexpr Fixed(int value) : m_raw(value * ONE) {};
+      constexpr Fixed(double value) :
+	 m_raw(value < 0 ? value * ONE - 0.5 : value * ONE + 0.5) {};
+
+      static Fixed from_raw(int16_t raw) {
+	 Fixed f;
+	 f.m_raw = raw;
+	 return f;
+      };
+
+      // numerator / denominator, rounded to the nearest step.
+      static Fixed ratio(int16_t numerator, int16_t denominator) {
+	 return from_raw(((int32_t) numerator * ONE + denominator / 2) /
+			 denominator);
+      };
+
+      int16_t raw() const {
+	 return m_raw;
+      };
+
+      // This value times n, rounded to the nearest integer. For
+      // mapping a ratio onto a range, such as pixels or contrast.
+      int16_t scale(int16_t n) const {
+	 return ((int32_t) m_raw * n + ONE / 2) >> 8;
+      };
+
+      Fixed operator+(Fixed other) const {
+	 return saturate((int32_t) m_raw + other.m_raw);
+      };
+
+      Fixed operator-(Fixed other) const {
+	 return saturate((int32_t) m_raw - other.m_raw);
+      };
+
+      Fixed operator*(Fixed other) const {
+	 return saturate(((int32_t) m_raw * other.m_raw) >> 8);
+      };
+
+      Fixed operator*(int n) const {
+	 return saturate((int32_t) m_raw * n);
+      };
+
+      Fixed &operator+=(Fixed other) {
+	 return *this = *this + other;
+      };
+
+      Fixed &operator-=(Fixed other) {
+	 return *this = *this - other;
+      };
+
+      boolean operator==(Fixed other) const {
+	 return m_raw == other.m_raw;
+      };
+
+      boolean operator!=(Fixed other) const {
+	 return m_raw != other.m_raw;
+      };
+
+      boolean operator<(Fixed other) const {
+	 return m_raw < other.m_raw;
+      };
+
+      boolean operator>(Fixed other) const {
+	 return m_raw > other.m_raw;
+      };
+
+   private:
+      static Fixed saturate(int32_t raw) {
+	 return from_raw(raw > INT16_MAX ? INT16_MAX :
+			 raw < INT16_MIN ? INT16_MIN : raw);
+      };
+
+      int16_t m_raw;
+};
+
+
+/*
+ * Where value lies between min and max, as a length out of length.
+ * RangeView uses this to size its bar.
+ */
+template <typename T>
+uint8_t proportion(T value, T min, T max, uint8_t length) {
+   return (length * (value - min)) / (max - min);
+}
+
+// One integer divide, rather than a soft-float one.
+template <>
+uint8_t proportion<Fixed>(Fixed value, Fixed min, Fixed max, uint8_t length) {
+   return ((int32_t) length * (value - min).raw()) / (max - min).raw();
+}
+
+#endif
@@ -0,0 +1,137 @@
+/* Font5x7.h
+ *
+ * 5x7 glyphs for printable ASCII, in the same column-major layout as
+ * the Adafruit_GFX font: five bytes per glyph, one byte per column,
+ * least significant bit at the top. Characters outside 0x20-0x7e are
+ * drawn as '?'.
+ *
+ * Adafruit_GFX keeps its own copy of this font private to
+ * drawChar(). Views which render text column by column, rather than
+ * a character at a time, read the glyphs from here instead.
+ */
+
+#ifndef FONT_5X7_H
+#define FONT_5X7_H
+
+// Glyphs are this wide, plus one blank column between characters.
+const uint8_t GLYPH_WIDTH = 5;
+const uint8_t CHAR_WIDTH = GLYPH_WIDTH + 1;
+
+static const uint8_t PROGMEM font5x7[] = {
+   0x00, 0x00, 0x00, 0x00, 0x00, // ' '
+   0x00, 0x00, 0x5f, 0x00, 0x00, // '!'
+   0x00, 0x07, 0x00, 0x07, 0x00, // '"'
+   0x14, 0x7f, 0x14, 0x7f, 0x14, // '#'
+   0x24, 0x2a, 0x7f, 0x2a, 0x12, // '$'
+   0x23, 0x13, 0x08, 0x64, 0x62, // '%'
+   0x36, 0x49, 0x56, 0x20, 0x50, // '&'
+   0x00, 0x08, 0x07, 0x03, 0x00, // '''
+   0x00, 0x1c, 0x22, 0x41, 0x00, // '('
+   0x00, 0x41, 0x22, 0x1c, 0x00, // ')'
+   0x2a, 0x1c, 0x7f, 0x1c, 0x2a, // '*'
+   0x08, 0x08, 0x3e, 0x08, 0x08, // '+'
+   0x00, 0x80, 0x70, 0x30, 0x00, // ','
+   0x08, 0x08, 0x08, 0x08, 0x08, // '-'
+   0x00, 0x00, 0x60, 0x60, 0x00, // '.'
+   0x20, 0x10, 0x08, 0x04, 0x02, // '/'
+   0x3e, 0x51, 0x49, 0x45, 0x3e, // '0'
+   0x00, 0x42, 0x7f, 0x40, 0x00, // '1'
+   0x72, 0x49, 0x49, 0x49, 0x46, // '2'
+   0x21, 0x41, 0x49, 0x4d, 0x33, // '3'
+   0x18, 0x14, 0x12, 0x7f, 0x10, // '4'
+   0x27, 0x45, 0x45, 0x45, 0x39, // '5'
+   0x3c, 0x4a, 0x49, 0x49, 0x31, // '6'
+   0x41, 0x21, 0x11, 0x09, 0x07, // '7'
+   0x36, 0x49, 0x49, 0x49, 0x36, // '8'
+   0x46, 0x49, 0x49, 0x29, 0x1e, // '9'
+   0x00, 0x00, 0x14, 0x00, 0x00, // ':'
+   0x00, 0x40, 0x34, 0x00, 0x00, // ';'
+   0x00, 0x08, 0x14, 0x22, 0x41, // '<'
+   0x14, 0x14, 0x14, 0x14, 0x14, // '='
+   0x00, 0x41, 0x22, 0x14, 0x08, // '>'
+   0x02, 0x01, 0x59, 0x09, 0x06, // '?'
+   0x3e, 0x41, 0x5d, 0x59, 0x4e, // '@'
+   0x7c, 0x12, 0x11, 0x12, 0x7c, // 'A'
+   0x7f, 0x49, 0x49, 0x49, 0x36, // 'B'
+   0x3e, 0x41, 0x41, 0x41, 0x22, // 'C'
+   0x7f, 0x41, 0x41, 0x41, 0x3e, // 'D'
+   0x7f, 0x49, 0x49, 0x49, 0x41, // 'E'
+   0x7f, 0x09, 0x09, 0x09, 0x01, // 'F'
+   0x3e, 0x41, 0x41, 0x51, 0x73, // 'G'
+   0x7f, 0x08, 0x08, 0x08, 0x7f, // 'H'
+   0x00, 0x41, 0x7f, 0x41, 0x00, // 'I'
+   0x20, 0x40, 0x41, 0x3f, 0x01, // 'J'
+   0x7f, 0x08, 0x14, 0x22, 0x41, // 'K'
+   0x7f, 0x40, 0x40, 0x40, 0x40, // 'L'
+   0x7f, 0x02, 0x1c, 0x02, 0x7f, // 'M'
+   0x7f, 0x04, 0x08, 0x10, 0x7f, // 'N'
+   0x3e, 0x41, 0x41, 0x41, 0x3e, // 'O'
+   0x7f, 0x09, 0x09, 0x09, 0x06, // 'P'
+   0x3e, 0x41, 0x51, 0x21, 0x5e, // 'Q'
+   0x7f, 0x09, 0x19, 0x29, 0x46, // 'R'
+   0x26, 0x49, 0x49, 0x49, 0x32, // 'S'
+   0x03, 0x01, 0x7f, 0x01, 0x03, // 'T'
+   0x3f, 0x40, 0x40, 0x40, 0x3f, // 'U'
+   0x1f, 0x20, 0x40, 0x20, 0x1f, // 'V'
+   0x3f, 0x40, 0x38, 0x40, 0x3f, // 'W'
+   0x63, 0x14, 0x08, 0x14, 0x63, // 'X'
+   0x03, 0x04, 0x78, 0x04, 0x03, // 'Y'
+   0x61, 0x59, 0x49, 0x4d, 0x43, // 'Z'
+   0x00, 0x7f, 0x41, 0x41, 0x41, // '['
+   0x02, 0x04, 0x08, 0x10, 0x20, // '\'
+   0x00, 0x41, 0x41, 0x41, 0x7f, // ']'
+   0x04, 0x02, 0x01, 0x02, 0x04, // '^'
+   0x40, 0x40, 0x40, 0x40, 0x40, // '_'
+   0x00, 0x03, 0x07, 0x08, 0x00, // '`'
+   0x20, 0x54, 0x54, 0x78, 0x40, // 'a'
+   0x7f, 0x28, 0x44, 0x44, 0x38, // 'b'
+   0x38, 0x44, 0x44, 0x44, 0x28, // 'c'
+   0x38, 0x44, 0x44, 0x28, 0x7f, // 'd'
+   0x38, 0x54, 0x54, 0x54, 0x18, // 'e'
+   0x00, 0x08, 0x7e, 0x09, 0x02, // 'f'
+   0x18, 0xa4, 0xa4, 0x9c, 0x78, // 'g'
+   0x7f, 0x08, 0x04, 0x04, 0x78, // 'h'
+   0x00, 0x44, 0x7d, 0x40, 0x00, // 'i'
+   0x20, 0x40, 0x40, 0x3d, 0x00, // 'j'
+   0x7f, 0x10, 0x28, 0x44, 0x00, // 'k'
+   0x00, 0x41, 0x7f, 0x40, 0x00, // 'l'
+   0x7c, 0x04, 0x78, 0x04, 0x78, // 'm'
+   0x7c, 0x08, 0x04, 0x04, 0x78, // 'n'
+   0x38, 0x44, 0x44, 0x44, 0x38, // 'o'
+   0xfc, 0x18, 0x24, 0x24, 0x18, // 'p'
+   0x18, 0x24, 0x24, 0x18, 0xfc, // 'q'
+   0x7c, 0x08, 0x04, 0x04, 0x08, // 'r'
+   0x48, 0x54, 0x54, 0x54, 0x24, // 's'
+   0x04, 0x04, 0x3f, 0x44, 0x24, // 't'
+   0x3c, 0x40, 0x40, 0x20, 0x7c, // 'u'
+   0x1c, 0x20, 0x40, 0x20, 0x1c, // 'v'
+   0x3c, 0x40, 0x30, 0x40, 0x3c, // 'w'
+   0x44, 0x28, 0x10, 0x28, 0x44, // 'x'
+   0x4c, 0x90, 0x90, 0x90, 0x7c, // 'y'
+   0x44, 0x64, 0x54, 0x4c, 0x44, // 'z'
+   0x00, 0x08, 0x36, 0x41, 0x00, // '{'
+   0x00, 0x00, 0x77, 0x00, 0x00, // '|'
+   0x00, 0x41, 0x36, 0x08, 0x00, // '}'
+   0x02, 0x01, 0x02, 0x04, 0x02, // '~'
+};
+
+// Returns the glyph for c, in program memory.
+static inline const uint8_t *glyph(unsigned char c) {
+   if (c < 0x20 || c > 0x7e) {
+      c = '?';
+   }
+   return font5x7 + (c - 0x20) * GLYPH_WIDTH;
+}
+
+// Column x of a line of text, counting the blank column after each
+// glyph. x must be less than CHAR_WIDTH * strlen(text).
+static inline uint8_t text_column(const char *text, unsigned int x) {
+   uint8_t column = x % CHAR_WIDTH;
+
+   if (column == GLYPH_WIDTH) {
+      return 0;
+   }
+   return pgm_read_byte(glyph(text[x / CHAR_WIDTH]) + column);
+}
+
+#endif
@@ -0,0 +1,150 @@
+/* Log.h
+ *
+ * Debug logging which doesn't disturb the timing it is used to
+ * debug.
+ *
+ * Printing straight to Serial blocks whenever the UART's transmit
+ * buffer is full, which at 9600 baud is about a millisecond per
+ * character: tracing each byte received over BLE stalled the loop
+ * for ~100ms per track name. Instead, messages are printed into a
+ * ring buffer in RAM, and log_drain(), called once per loop(), moves
+ * as much of it to Serial as fits without blocking. Messages which
+ * don't fit in the ring are cut short, and the lost bytes counted.
+ *
+ * Each message has a level, and LOG_LEVEL selects which are compiled
+ * in. Define it before including anything:
+ *
+ *   #define LOG_LEVEL LOG_LEVEL_DEBUG
+ *
+ * The default is LOG_LEVEL_WARN. Messages above LOG_LEVEL compile to
+ * nothing, arguments included, and with LOG_LEVEL_NONE there is no
+ * buffer at all. Use F() for string literals, so they stay in flash.
+ */
+
+#ifndef LOG_H
+#define LOG_H
+
+#define LOG_LEVEL_NONE  0
+#define LOG_LEVEL_ERROR 1
+#define LOG_LEVEL_WARN  2
+#define LOG_LEVEL_INFO  3
+#define LOG_LEVEL_DEBUG 4
+
+#ifndef LOG_LEVEL
+#define LOG_LEVEL LOG_LEVEL_WARN
+#endif
+
+#ifndef LOG_BUFFER_SIZE
+#define LOG_BUFFER_SIZE 64
+#endif
+
+
+/*
+ * A ring of characters, filled through Print and emptied to another
+ * Print by drain().
+ */
+template <uint8_t SIZE>
+class LogBuffer : public Print {
+   public:
+      LogBuffer() :
+	 m_front(0),
+	 m_count(0),
+	 m_dropped(0) {
+      };
+
+      size_t write(uint8_t c) {
+	 if (m_count == SIZE) {
+	    m_dropped++;
+	    return 0;
+	 }
+	 m_buffer[(m_front + m_count) % SIZE] = c;
+	 m_count++;
+	 return 1;
+      };
+
+      using Print::write;
+
+      // Prints a message, prefixed with the first letter of its
+      // level.
+      template <typename A>
+      void line(char level, const A &a) {
+	 print(level);
+	 print(' ');
+	 println(a);
+      };
+
+      template <typename A, typename B>
+      void line(char level, const A &a, const B &b) {
+	 print(level);
+	 print(' ');
+	 print(a);
+	 println(b);
+      };
+
+      template <typename A, typename B, typename C>
+      void line(char level, const A &a, const B &b, const C &c) {
+	 print(level);
+	 print(' ');
+	 print(a);
+	 print(b);
+	 print(' ');
+	 println(c);
+      };
+
+      // Writes out at most as many characters as out can take
+      // without blocking.
+      void drain(Print &out) {
+	 uint8_t n = min(m_count, out.availableForWrite());
+
+	 while (n--) {
+	    out.write(m_buffer[m_front]);
+	    m_front = (m_front + 1) % SIZE;
+	    m_count--;
+	 }
+      };
+
+      // Characters lost because the ring was full.
+      uint16_t dropped() {
+	 return m_dropped;
+      };
+
+   private:
+      char m_buffer[SIZE];
+      uint8_t m_front;
+      uint8_t m_count;
+      uint16_t m_dropped;
+};
+
+
+#if LOG_LEVEL > LOG_LEVEL_NONE
+LogBuffer<LOG_BUFFER_SIZE> g_log;
+#define log_drain() g_log.drain(Serial)
+#else
+#define log_drain() do {} while (0)
+#endif
+
+#if LOG_LEVEL >= LOG_LEVEL_ERROR
+#define log_error(...) g_log.line('E', __VA_ARGS__)
+#else
+#define log_error(...) do {} while (0)
+#endif
+
+#if LOG_LEVEL >= LOG_LEVEL_WARN
+#define log_warn(...) g_log.line('W', __VA_ARGS__)
+#else
+#define log_warn(...) do {} while (0)
+#endif
+
+#if LOG_LEVEL >= LOG_LEVEL_INFO
+#define log_info(...) g_log.line('I', __VA_ARGS__)
+#else
+#define log_info(...) do {} while (0)
+#endif
+
+#if LOG_LEVEL >= LOG_LEVEL_DEBUG
+#define log_debug(...) g_log.line('D', __VA_ARGS__)
+#else
+#define log_debug(...) do {} while (0)
+#endif
+
+#endif
@@ -15,23 +15,13 @@
  * then be automatically cleared at the end of the event loop tick.
  *
  * Model becomes dirty when its value is updates. It is considered
- * dirty until it is explicitly reset.
+ * dirty until it is explicitly reset, which UI::loop() does for every
+ * model at the end of each tick (see DirtyFlag in UserInterface.h).
  */
-template <typename T> class Model {
+template <typename T> class Model : public DirtyFlag {
   public:
    virtual void update(T value);
    virtual T value();
-   
-   boolean dirty() {
-      return m_dirty;
-   };
-
-   void reset() {
-      m_dirty = false;
-   };
-
-  protected:
-    boolean m_dirty;
 };
 
 
@@ -87,9 +77,137 @@ template <typename T> class ProxyModel : public Model<T> {
 };
 
 
+/*
+ * A proxy model for a remote value which the user adjusts locally in
+ * relative steps, such as the phone's volume.
+ *
+ * Waiting for the remote end to echo every change back costs the user
+ * a full round trip of lag. Instead, adjust() applies a local change
+ * immediately. The controller which sends changes numbers each
+ * message with next_seq(), and calls sent() once it is on its way.
+ * The remote end is expected to answer with the number and the
+ * resulting value, which arrive through ack().
+ *
+ * Up to DEPTH sent changes may be unacknowledged at once; ready()
+ * reports whether there is room for another. An ack() retires the
+ * change it names and any older ones, since the remote applies them
+ * in order, and the value shown is always the last remote value plus
+ * everything the remote hasn't applied yet. So an echo which predates
+ * the user's latest changes doesn't make the value jump backwards,
+ * and once everything is acknowledged the value is exactly the remote
+ * one. Changes which go unacknowledged for longer than TIMEOUT ms are
+ * assumed lost; expire() checks for those, and should be called
+ * regularly, as there may be no other traffic to notice them by.
+ * forget() gives up on every change in flight, say when the link to
+ * the remote end is lost.
+ *
+ * The remote may also report its value unasked, say when it is
+ * changed at the other end. update() takes that as the new remote
+ * value, leaving the changes in flight to be acknowledged as usual.
+ */
+template <typename T, uint8_t DEPTH>
+class ReconciledModel : public ProxyModel<T> {
+  public:
+    ReconciledModel(T initial, T min, T max) :
+      ProxyModel<T>(initial),
+      m_remote(initial),
+      m_local(0),
+      m_min(min),
+      m_max(max),
+      m_front(0),
+      m_count(0),
+      m_seq(0) {
+    };
+
+    // An authoritative value from the remote end, not an answer to
+    // any change.
+    void update(T value) {
+      m_remote = value;
+      expire();
+      show();
+    };
+
+    // The remote end's answer to the change numbered seq.
+    void ack(uint8_t seq, T value) {
+      m_remote = value;
+      while (m_count && (int8_t) (seq - m_seqs[m_front]) >= 0) {
+	m_front = (m_front + 1) % DEPTH;
+	m_count--;
+      }
+      show();
+    };
+
+    // A local change, not yet sent.
+    void adjust(T delta) {
+      m_local += delta;
+      show();
+    };
+
+    boolean ready() {
+      expire();
+      return m_count < DEPTH;
+    };
+
+    // delta, out of the local changes, has been sent, numbered
+    // next_seq().
+    void sent(T delta) {
+      uint8_t i = (m_front + m_count) % DEPTH;
+
+      m_local -= delta;
+      m_sent[i] = delta;
+      m_seqs[i] = ++m_seq;
+      m_count++;
+      m_time = millis();
+    };
+
+    // The number to send the next change with.
+    uint8_t next_seq() {
+      return m_seq + 1;
+    };
+
+    void expire() {
+      if (m_count && (unsigned long) (millis() - m_time) > TIMEOUT) {
+	forget();
+      }
+    };
+
+    void forget() {
+      m_count = 0;
+      show();
+    };
+
+  private:
+    static const unsigned int TIMEOUT = 1000;
+
+    void show() {
+      T value = m_remote + m_local;
+      for (uint8_t i = 0; i < m_count; i++) {
+	value += m_sent[(m_front + i) % DEPTH];
+      }
+      value = constrain(value, m_min, m_max);
+      if (value != ProxyModel<T>::value()) {
+	ProxyModel<T>::proxy_set(value);
+      }
+    };
+
+    T m_remote;
+    T m_local;
+    T m_min;
+    T m_max;
+    T m_sent[DEPTH];
+    uint8_t m_seqs[DEPTH];
+    uint8_t m_front;
+    uint8_t m_count;
+    uint8_t m_seq;
+    unsigned long m_time;
+};
+
+
 /*
  * Special case model for fixed-length character arrays. Update copies
- * the string into the internal buffer.
+ * the string into the internal buffer. The initial value may be given
+ * with F(), so that it is copied from flash rather than also kept in
+ * RAM.
  */
 template<uint8_t SIZE>
 class DirectStringModel : public Model<const char *> {
@@ -98,6 +216,10 @@ class DirectStringModel : public Model<const char *> {
       strncpy(m_buffer, initial, SIZE);
     };
 
+    DirectStringModel(const __FlashStringHelper *initial) {
+      strncpy_P(m_buffer, (PGM_P) initial, SIZE);
+    };
+
     void update(const char *value) {
       strncpy(m_buffer, value, SIZE);
       Model<const char *>::m_dirty = true;
@@ -112,12 +234,209 @@ class DirectStringModel : public Model<const char *> {
 };
 
 
+/*
+ * A string model which is filled in a character at a time, such as
+ * from a serial stream, without ever showing a partial value.
+ *
+ * Characters are appended to a second, staging buffer, while value()
+ * goes on returning the last complete string. commit() then makes the
+ * staged string the value by swapping the two buffers, and marks the
+ * model dirty, so each new value costs views exactly one redraw. A
+ * value identical to the current one is dropped without dirtying the
+ * model. update() stages and commits a whole string at once, so it
+ * discards anything being staged; replace() changes the value shown
+ * and leaves the staging buffer alone.
+ *
+ * SIZE includes the terminating NUL, and characters beyond it are
+ * dropped.
+ */
+template<uint8_t SIZE>
+class StagedStringModel : public Model<const char *> {
+  public:
+    StagedStringModel(const char *initial) :
+      m_front(0) {
+      begin();
+      strncpy(m_buffers[0], initial, SIZE - 1);
+      m_buffers[0][SIZE - 1] = 0;
+    };
+
+    StagedStringModel(const __FlashStringHelper *initial) :
+      m_front(0) {
+      begin();
+      strncpy_P(m_buffers[0], (PGM_P) initial, SIZE - 1);
+      m_buffers[0][SIZE - 1] = 0;
+    };
+
+    void update(const char *value) {
+      begin();
+      strncpy(back(), value, SIZE - 1);
+      commit();
+    };
+
+    const char *value() {
+      return m_buffers[m_front];
+    };
+
+    void replace(const char *value) {
+      if (strncmp(front(), value, SIZE - 1)) {
+	strncpy(front(), value, SIZE - 1);
+	Model<const char *>::m_dirty = true;
+      }
+    };
+
+    // Discards anything staged, and starts a new value.
+    void begin() {
+      m_length = 0;
+      memset(back(), 0, SIZE);
+    };
+
+    // Returns false, dropping c, if the staging buffer is full.
+    boolean append(char c) {
+      if (m_length == SIZE - 1) {
+	return false;
+      }
+      back()[m_length++] = c;
+      return true;
+    };
+
+    void commit() {
+      if (strcmp(back(), value())) {
+	m_front ^= 1;
+	Model<const char *>::m_dirty = true;
+      }
+      begin();
+    };
+
+  private:
+    char *front() {
+      return m_buffers[m_front];
+    };
+
+    char *back() {
+      return m_buffers[m_front ^ 1];
+    };
+
+    char m_buffers[2][SIZE];
+    uint8_t m_front;
+    uint8_t m_length;
+};
+
+
+/*
+ * A fixed number of strings out of a longer numbered list, such as
+ * the rows of a ListView, of which the least recently used is
+ * replaced when a new one is put(). Each holds up to SIZE - 1
+ * characters.
+ */
+template<uint8_t N, uint8_t SIZE>
+class EntryCache {
+  public:
+    static const uint16_t NONE = 0xffff;
+
+    EntryCache() :
+      m_clock(0) {
+      clear();
+    };
+
+    void clear() {
+      for (uint8_t i = 0; i < N; i++) {
+	m_entries[i].index = NONE;
+      }
+    };
+
+    // The entry for index, or 0 if it isn't cached.
+    const char *get(uint16_t index) {
+      Entry *entry = find(index);
+
+      if (!entry) {
+	return 0;
+      }
+      entry->used = ++m_clock;
+      return entry->text;
+    };
+
+    void put(uint16_t index, const char *text) {
+      Entry *entry = find(index);
+
+      if (!entry) {
+	entry = &m_entries[0];
+	for (uint8_t i = 1; i < N; i++) {
+	  if (age(m_entries[i]) > age(*entry)) {
+	    entry = &m_entries[i];
+	  }
+	}
+      }
+
+      entry->index = index;
+      entry->used = ++m_clock;
+      strncpy(entry->text, text, SIZE - 1);
+      entry->text[SIZE - 1] = 0;
+    };
+
+    boolean contains(uint16_t index) {
+      return find(index) != 0;
+    };
+
+  private:
+    struct Entry {
+      uint16_t index;
+      uint16_t used;
+      char text[SIZE];
+    };
+
+    Entry *find(uint16_t index) {
+      for (uint8_t i = 0; i < N; i++) {
+	if (m_entries[i].index == index) {
+	  return &m_entries[i];
+	}
+      }
+      return 0;
+    };
+
+    // Empty entries are the oldest of all. Ages are differences, so
+    // the clock may wrap.
+    uint16_t age(const Entry &entry) {
+      return entry.index == NONE ? 0xffff : m_clock - entry.used;
+    };
+
+    Entry m_entries[N];
+    uint16_t m_clock;
+};
+
+
 /*
  * Controller Base class
+ *
+ * Each controller declares the events it handles with a route: an
+ * event source and data value, either of which may be ANY. Containers
+ * test the route, which is a couple of byte compares, and only make
+ * the virtual handle_event() call for events which match it, so
+ * handle_event() need not check them again.
  */
 class Controller {
   public:
+    static const uint8_t ANY = 0xff;
+
+    Controller(uint8_t source = ANY, uint8_t data = ANY) :
+      m_source(source),
+      m_data(data) {
+    };
+
     virtual void handle_event(UI &ui, Event &event);
+
+    boolean routes(const Event &event) {
+      return
+	(m_source == ANY || m_source == event.source) &&
+	(m_data == ANY || m_data == event.data);
+    };
+
+    uint8_t source() {
+      return m_source;
+    };
+
+  private:
+    const uint8_t m_source;
+    const uint8_t m_data;
 };
 
 
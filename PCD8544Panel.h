@@ -0,0 +1,280 @@
+/* PCD8544Panel.h
+ *
+ * Extensions to the Adafruit PCD8544 driver which exploit the
+ * layout of the controller's memory.
+ *
+ * The PCD8544 stores the 84x48 image as six horizontal banks, each
+ * 8 pixels high, with one byte per column. The Adafruit driver keeps
+ * a copy of this in RAM, and display() sends all 504 bytes of it over
+ * (bit-banged) SPI every time it is called. That is by far the most
+ * expensive thing the firmware does, and usually pointless, since
+ * most ticks change nothing at all.
+ *
+ * Drawing suffers from the layout too: Adafruit_GFX reduces
+ * everything to drawPixel(), which sets one bit of one byte per call,
+ * so a character is some 40 calls. Filled areas and text are far
+ * cheaper done a byte at a time, since a column 8 pixels high which
+ * starts on a bank boundary is a single byte of the framebuffer, and
+ * one which doesn't straddles two.
+ */
+
+#ifndef PCD8544_PANEL_H
+#define PCD8544_PANEL_H
+
+#include <Adafruit_PCD8544.h>
+#include "UserInterface.h"
+#include "Font5x7.h"
+
+/*
+ * The driver's framebuffer. It isn't declared in the driver's header,
+ * but it is a global in Adafruit_PCD8544.cpp.
+ */
+extern uint8_t pcd8544_buffer[];
+
+
+/*
+ * A PCD8544 display which tracks which parts of the framebuffer have
+ * been damaged since the last flush.
+ *
+ * Damage is recorded per bank as a range of columns, so the whole
+ * table costs 12 bytes. Pass the panel to UI as its DamageListener,
+ * and call flush() instead of display(): only the damaged column
+ * range of each damaged bank is sent, and if nothing was damaged
+ * nothing is sent at all.
+ *
+ * Drawing directly to the display outside of UI::loop() bypasses the
+ * damage tracking; call damage() for the affected region, or
+ * damage_all().
+ *
+ * The panel also replaces the generic drawing of vertical lines,
+ * filled rects and size 1 text with versions which write whole bytes
+ * of the framebuffer. They assume the display isn't rotated, and
+ * defer to Adafruit_GFX if it is. Pass the panel to UI as its
+ * ColumnWriter too, and icons and clipped text are drawn through
+ * draw_column() a byte at a time as well.
+ */
+class PCD8544Panel : public Adafruit_PCD8544,
+		     public DamageListener,
+		     public ColumnWriter {
+   public:
+      PCD8544Panel(int8_t sclk,
+		   int8_t din,
+		   int8_t dc,
+		   int8_t cs,
+		   int8_t rst) :
+	 Adafruit_PCD8544(sclk, din, dc, cs, rst)
+      {
+	 damage_all();
+      };
+
+      void damage(const Rect &where) {
+	 if (!where.w || !where.h ||
+	     where.x >= LCDWIDTH || where.y >= LCDHEIGHT) {
+	    return;
+	 }
+
+	 uint8_t first = where.x;
+	 uint8_t last = min(where.x + where.w, LCDWIDTH) - 1;
+	 uint8_t bottom = min(where.y + where.h, LCDHEIGHT) - 1;
+
+	 for (uint8_t bank = where.y / 8; bank <= bottom / 8; bank++) {
+	    if (first < m_first[bank]) {
+	       m_first[bank] = first;
+	    }
+	    if (last > m_last[bank]) {
+	       m_last[bank] = last;
+	    }
+	 }
+      };
+
+      void damage_all() {
+	 for (uint8_t bank = 0; bank < BANKS; bank++) {
+	    m_first[bank] = 0;
+	    m_last[bank] = LCDWIDTH - 1;
+	 }
+      };
+
+      boolean damaged() {
+	 for (uint8_t bank = 0; bank < BANKS; bank++) {
+	    if (m_first[bank] <= m_last[bank]) {
+	       return true;
+	    }
+	 }
+	 return false;
+      };
+
+      // Sends the damaged parts of the framebuffer to the panel.
+      void flush() {
+	 boolean sent = false;
+
+	 for (uint8_t bank = 0; bank < BANKS; bank++) {
+	    if (m_first[bank] > m_last[bank]) {
+	       continue;
+	    }
+
+	    // The panel advances its column address after each byte,
+	    // so one address command per bank is enough.
+	    command(PCD8544_SETYADDR | bank);
+	    command(PCD8544_SETXADDR | m_first[bank]);
+
+	    uint8_t *p = pcd8544_buffer + bank * LCDWIDTH + m_first[bank];
+	    for (uint8_t x = m_first[bank]; x <= m_last[bank]; x++) {
+	       data(*p++);
+	    }
+
+	    m_first[bank] = CLEAN;
+	    m_last[bank] = 0;
+	    sent = true;
+	 }
+
+	 // Adafruit_PCD8544::display() does this after the last byte
+	 // too; the panel appears to need it.
+	 if (sent) {
+	    command(PCD8544_SETYADDR);
+	 }
+      };
+
+      /*
+       * Draws up to 8 pixels of a column, given as bits with the
+       * least significant at the top, so a glyph column from
+       * Font5x7.h can be drawn as is. Set bits are drawn in color;
+       * clear bits are drawn in bg, or left alone if bg == color, as
+       * with Adafruit_GFX::drawChar(). At a y on a bank boundary this
+       * is one byte of the framebuffer; anywhere else it is two.
+       */
+      void draw_column(int16_t x, int16_t y,
+		       uint8_t bits, uint8_t h,
+		       uint16_t color, uint16_t bg) {
+	 if (rotation) {
+	    for (uint8_t i = 0; i < h; i++) {
+	       if (bits & (1 << i)) {
+		  drawPixel(x, y + i, color);
+	       } else if (bg != color) {
+		  drawPixel(x, y + i, bg);
+	       }
+	    }
+	    return;
+	 }
+
+	 if (x < 0 || x >= LCDWIDTH || y >= LCDHEIGHT || y + h <= 0) {
+	    return;
+	 }
+
+	 uint8_t rows = h < 8 ? (1 << h) - 1 : 0xff;
+	 uint8_t mask, value;
+
+	 if (bg == color) {
+	    mask = bits & rows;
+	    value = color ? 0xff : 0;
+	 } else {
+	    mask = rows;
+	    value = color ? bits : ~bits;
+	 }
+
+	 int8_t bank = y >> 3;
+	 uint8_t shift = y & 7;
+	 uint16_t wide_mask = (uint16_t) mask << shift;
+	 uint16_t wide_value = (uint16_t) value << shift;
+	 uint8_t *p = pcd8544_buffer + bank * LCDWIDTH + x;
+
+	 if (bank >= 0) {
+	    blend(p, wide_mask, wide_value);
+	 }
+	 if (shift && bank + 1 < BANKS) {
+	    blend(p + LCDWIDTH, wide_mask >> 8, wide_value >> 8);
+	 }
+      };
+
+      void drawFastVLine(int16_t x, int16_t y, int16_t h, uint16_t color) {
+	 fillRect(x, y, 1, h, color);
+      };
+
+      // Works a bank at a time: the mask for the rows of the rect in
+      // the bank is worked out once, then applied to each column.
+      void fillRect(int16_t x, int16_t y,
+		    int16_t w, int16_t h,
+		    uint16_t color) {
+	 if (rotation) {
+	    Adafruit_PCD8544::fillRect(x, y, w, h, color);
+	    return;
+	 }
+
+	 if (x < 0) {
+	    w += x;
+	    x = 0;
+	 }
+	 if (y < 0) {
+	    h += y;
+	    y = 0;
+	 }
+	 w = min(w, LCDWIDTH - x);
+	 h = min(h, LCDHEIGHT - y);
+	 if (w <= 0 || h <= 0) {
+	    return;
+	 }
+
+	 uint8_t *row = pcd8544_buffer + (y >> 3) * LCDWIDTH + x;
+	 uint8_t shift = y & 7;
+
+	 while (h > 0) {
+	    uint8_t n = min(8 - shift, h);
+	    uint8_t mask = ((1 << n) - 1) << shift;
+
+	    if (mask == 0xff) {
+	       memset(row, color ? 0xff : 0, w);
+	    } else {
+	       for (uint8_t *p = row; p < row + w; p++) {
+		  blend(p, mask, color ? 0xff : 0);
+	       }
+	    }
+
+	    h -= n;
+	    shift = 0;
+	    row += LCDWIDTH;
+	 }
+      };
+
+      // Renders size 1 text with draw_column(), and anything else
+      // with Adafruit_GFX. Cursor movement and wrapping are the same.
+      size_t write(uint8_t c) {
+	 if (textsize != 1 || rotation) {
+	    return Adafruit_PCD8544::write(c);
+	 }
+
+	 if (c == '\n') {
+	    cursor_y += 8;
+	    cursor_x = 0;
+	 } else if (c != '\r') {
+	    const uint8_t *bitmap = glyph(c);
+
+	    for (uint8_t i = 0; i < CHAR_WIDTH; i++) {
+	       uint8_t bits = i < GLYPH_WIDTH ? pgm_read_byte(bitmap + i) : 0;
+	       draw_column(cursor_x + i, cursor_y, bits, 8,
+			   textcolor, textbgcolor);
+	    }
+
+	    cursor_x += CHAR_WIDTH;
+	    if (wrap && cursor_x > _width - CHAR_WIDTH) {
+	       cursor_y += 8;
+	       cursor_x = 0;
+	    }
+	 }
+	 return 1;
+      };
+
+      using Adafruit_PCD8544::write;
+
+   private:
+      static void blend(uint8_t *p, uint8_t mask, uint8_t value) {
+	 *p = (*p & ~mask) | (value & mask);
+      };
+
+      static const uint8_t BANKS = LCDHEIGHT / 8;
+      static const uint8_t CLEAN = 0xff;
+
+      // A bank is clean when m_first > m_last.
+      uint8_t m_first[BANKS];
+      uint8_t m_last[BANKS];
+};
+
+#endif
@@ -0,0 +1,197 @@
+/* Profile.h
+ *
+ * Optional instrumentation of the main loop, for finding out where
+ * the time goes on real units.
+ *
+ * Each stage of the loop is timed with PROFILE_SCOPE(stage), which
+ * measures from there to the end of the enclosing block. For every
+ * stage the Profiler keeps the minimum, maximum and mean duration,
+ * and a histogram in eight buckets, each four times as wide as the
+ * last: under 16us, under 64us, and so on up to 64ms and over. The
+ * table is a fixed size, and the sketch dumps it on request, a row at
+ * a time so as not to block.
+ *
+ * Profiling costs RAM and a call to micros() at both ends of every
+ * stage, so it is off unless the sketch defines PROFILE as 1 before
+ * including anything. Otherwise PROFILE_SCOPE compiles to nothing.
+ */
+
+#ifndef PROFILE_H
+#define PROFILE_H
+
+#ifndef PROFILE
+#define PROFILE 0
+#endif
+
+/*
+ * The stages which are timed. A screen which profiles its views
+ * individually takes a block of PROFILE_VIEWS stages, starting at the
+ * one given to it.
+ */
+const uint8_t PROFILE_VIEWS = 8;
+
+typedef enum {
+   PROFILE_POLL,       // polling input sources
+   PROFILE_RECEIVE,    // handling bytes received over BLE
+   PROFILE_BLE_EVENTS, // ble_do_events()
+   PROFILE_DISPATCH,   // UI::loop() dispatching events
+   PROFILE_REDRAW,     // UI::loop() redrawing
+   PROFILE_FLUSH,      // sending the framebuffer to the panel
+   PROFILE_HOME_VIEWS, // views of the home screen
+   PROFILE_STAGES = PROFILE_HOME_VIEWS + PROFILE_VIEWS,
+   PROFILE_NONE = 0xff
+} ProfileStage;
+
+const uint8_t PROFILE_BUCKETS = 8;
+
+
+/*
+ * Timings of one stage. Counts are kept small: when one would
+ * overflow, it and its companions are halved, which keeps the mean
+ * and the shape of the histogram while favouring recent history.
+ */
+struct StageStats {
+   uint16_t count;
+   uint16_t min;
+   uint16_t max;
+   uint32_t total;
+   uint8_t buckets[PROFILE_BUCKETS];
+
+   void reset() {
+      memset(this, 0, sizeof(*this));
+      min = 0xffff;
+   };
+
+   void record(uint16_t us) {
+      if (count == 0xffff) {
+	 count /= 2;
+	 total /= 2;
+      }
+      count++;
+      total += us;
+      min = min < us ? min : us;
+      max = max > us ? max : us;
+
+      // Durations are clamped to 0xffff when measured, so that is
+      // the last bucket's: everything from 64ms up.
+      uint8_t bucket = 0;
+      for (uint32_t limit = 16;
+	   bucket < PROFILE_BUCKETS - 1 && (us >= limit || us == 0xffff);
+	   limit *= 4) {
+	 bucket++;
+      }
+
+      if (buckets[bucket] == 0xff) {
+	 for (uint8_t i = 0; i < PROFILE_BUCKETS; i++) {
+	    buckets[i] /= 2;
+	 }
+      }
+      buckets[bucket]++;
+   };
+
+   uint16_t mean() {
+      return count ? total / count : 0;
+   };
+};
+
+
+class Profiler {
+   public:
+      Profiler() {
+	 reset();
+      };
+
+      void reset() {
+	 for (uint8_t i = 0; i < PROFILE_STAGES; i++) {
+	    m_stages[i].reset();
+	 }
+      };
+
+      void record(uint8_t stage, uint16_t us) {
+	 if (stage < PROFILE_STAGES) {
+	    m_stages[stage].record(us);
+	 }
+      };
+
+      StageStats &stage(uint8_t stage) {
+	 return m_stages[stage];
+      };
+
+      // Prints one row of the table as text:
+      //   stage count min max mean bucket0,...,bucket7
+      void print_row(Print &out, uint8_t stage) {
+	 StageStats &s = m_stages[stage];
+
+	 out.print(stage);
+	 out.print(' ');
+	 out.print(s.count);
+	 out.print(' ');
+	 out.print(s.count ? s.min : 0);
+	 out.print(' ');
+	 out.print(s.max);
+	 out.print(' ');
+	 out.print(s.mean());
+	 for (uint8_t i = 0; i < PROFILE_BUCKETS; i++) {
+	    out.print(i ? ',' : ' ');
+	    out.print(s.buckets[i]);
+	 }
+	 out.println();
+      };
+
+      // Packs one row of the table into PROFILE_ROW_SIZE bytes:
+      //   stage, count, min, max, mean, buckets[8]
+      // with 16-bit values little-endian. Returns the size.
+      uint8_t pack_row(uint8_t *row, uint8_t stage) {
+	 StageStats &s = m_stages[stage];
+	 uint16_t values[] = {s.count, s.count ? s.min : (uint16_t) 0, s.max, s.mean()};
+	 uint8_t n = 0;
+
+	 row[n++] = stage;
+	 for (uint8_t i = 0; i < 4; i++) {
+	    row[n++] = values[i] & 0xff;
+	    row[n++] = values[i] >> 8;
+	 }
+	 memcpy(row + n, s.buckets, PROFILE_BUCKETS);
+	 return n + PROFILE_BUCKETS;
+      };
+
+   private:
+      StageStats m_stages[PROFILE_STAGES];
+};
+
+// The longest row print_row() produces, and the length of those
+// from pack_row().
+const uint8_t PROFILE_LINE_SIZE = 60;
+const uint8_t PROFILE_ROW_SIZE = 1 + 4 * 2 + PROFILE_BUCKETS;
+
+
+#if PROFILE
+Profiler g_profiler;
+
+/*
+ * Records the time from its construction to its destruction.
+ */
+class ProfileScope {
+   public:
+      ProfileScope(uint8_t stage) :
+	 m_stage(stage),
+	 m_start(micros()) {
+      };
+
+      ~ProfileScope() {
+	 unsigned long us = micros() - m_start;
+
+	 g_profiler.record(m_stage, us > 0xffff ? 0xffff : us);
+      };
+
+   private:
+      uint8_t m_stage;
+      unsigned long m_start;
+};
+
+#define PROFILE_SCOPE(stage) ProfileScope profile_scope(stage)
+#else
+#define PROFILE_SCOPE(stage) do {} while (0)
+#endif
+
+#endif
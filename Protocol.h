@@ -0,0 +1,320 @@
+/* Protocol.h
+ *
+ * Binary framing for messages exchanged with the phone over the BLE
+ * serial link.
+ *
+ * The original protocol is ASCII, parsed one character at a time by
+ * BtInput::put(). It has no framing and no error detection, and
+ * every update is a separate transfer. Frames fix all three, while
+ * remaining easy to parse in constant space:
+ *
+ *   FRAME_START  type  length  payload[length]  check
+ *
+ * check is a CRC-8 over type, length and payload. Frames may be sent
+ * back to back, so a track change (source, artist, track, volume)
+ * fits in a few 20-byte BLE packets rather than four transfers.
+ *
+ * FRAME_START is a control character which never begins an ASCII
+ * command, so the text protocol remains available as a fallback: the
+ * receiver looks for FRAME_START only where a text command could
+ * begin, and hands the bytes which follow to a FrameDecoder.
+ *
+ * In the other direction, commands for the phone are queued in a
+ * TxQueue and sent in as few packets as possible.
+ */
+
+#ifndef PROTOCOL_H
+#define PROTOCOL_H
+
+#include <RBL_nRF8001.h>
+
+const uint8_t FRAME_START = 0x02;
+
+// Largest payload the nRF8001 carries in one packet.
+const uint8_t BLE_PACKET_SIZE = 20;
+
+/*
+ * Message types. Single-byte payloads are unsigned unless noted, and
+ * 2-byte ones little-endian; strings are not NUL-terminated.
+ *
+ * The phone answers MSG_LIST_REQUEST with MSG_LIST_SIZE, then a
+ * MSG_LIST_ENTRY for each playlist asked for which exists.
+ *
+ * Album art is sent as MSG_ART_START, then one MSG_ART_DATA at a
+ * time: the phone waits for MSG_ART_ACK before sending the next.
+ */
+typedef enum {
+   // Sent by the phone.
+   MSG_PLAYING = 1,  // 1 byte: nonzero while playing
+   MSG_ONLINE,       // 1 byte: nonzero when online
+   MSG_VOLUME,       // 1 byte: 0 - 255
+   MSG_SOURCE,       // string
+   MSG_ARTIST,       // string
+   MSG_TRACK,        // string
+   MSG_NEXT_ARTIST,  // string: of the track after this one
+   MSG_NEXT_TRACK,   // string
+   MSG_PREV_ARTIST,  // string: of the track before this one
+   MSG_PREV_TRACK,   // string
+   MSG_LIST_SIZE,    // 2 bytes: number of playlists
+   MSG_LIST_ENTRY,   // 2 bytes: index, then string: playlist name
+   MSG_ART_START,    // 2 bytes: width, height of the album art
+   MSG_ART_DATA,     // next chunk of the art, see StreamedImage
+   MSG_VOLUME_ACK,   // 2 bytes: MSG_VOLUME_DELTA number, volume 0 - 255
+
+   // Sent by the remote. The phone answers each MSG_VOLUME_DELTA
+   // with MSG_VOLUME_ACK, giving the number it was sent with.
+   MSG_VOLUME_DELTA = 0x40, // 1 byte: number, 1 byte, signed: steps
+   MSG_PROFILE,             // one row of timings, see Profiler::pack_row()
+   MSG_LIST_REQUEST,        // 2 bytes: first index, 1 byte: count
+   MSG_LIST_SELECT,         // 2 bytes: index of the playlist to play
+   MSG_ART_ACK,             // empty: the last chunk of art is drawn
+   MSG_ART_REQUEST,         // empty: send the art again from the start
+   MSG_TASK_PROFILE,        // 1 byte: task name, 2 bytes: overruns,
+			    // 2 bytes: longest run in us
+} MessageType;
+
+
+/*
+ * CRC-8 with polynomial x^8 + x^2 + x + 1, processing one byte.
+ */
+uint8_t crc8(uint8_t crc, uint8_t c) {
+   crc ^= c;
+   for (uint8_t i = 0; i < 8; i++) {
+      crc = (crc & 0x80) ? (crc << 1) ^ 0x07 : crc << 1;
+   }
+   return crc;
+}
+
+
+/*
+ * Reassembles frames from a byte stream. Feed it the bytes following
+ * FRAME_START with put(), which returns true once a complete frame
+ * with a valid check byte has been received. The payload is then
+ * available, NUL-terminated for convenience, until the next call to
+ * put(). Frames which are too long for the buffer or fail the check
+ * are dropped and counted in errors().
+ *
+ * The decoder holds at most one frame, so the space it needs is
+ * fixed by SIZE, the largest payload the application accepts.
+ */
+template <uint8_t SIZE>
+class FrameDecoder {
+   public:
+      FrameDecoder() :
+	 m_state(IDLE),
+	 m_errors(0) {
+      };
+
+      // Prepares to receive a frame. Call on FRAME_START.
+      void start() {
+	 m_state = TYPE;
+	 m_crc = 0;
+      };
+
+      // Drops the frame being received, if any, as an error.
+      void abandon() {
+	 if (m_state != IDLE) {
+	    m_errors++;
+	    m_state = IDLE;
+	 }
+      };
+
+      // True between start() and the end of the frame.
+      boolean active() {
+	 return m_state != IDLE;
+      };
+
+      boolean put(uint8_t c) {
+	 switch (m_state) {
+	    case IDLE:
+	       return false;
+
+	    case TYPE:
+	       m_type = c;
+	       m_crc = crc8(m_crc, c);
+	       m_state = LENGTH;
+	       return false;
+
+	    case LENGTH:
+	       if (c > SIZE) {
+		  m_errors++;
+		  m_state = IDLE;
+		  return false;
+	       }
+	       m_length = c;
+	       m_index = 0;
+	       m_crc = crc8(m_crc, c);
+	       m_state = c ? PAYLOAD : CHECK;
+	       return false;
+
+	    case PAYLOAD:
+	       m_payload[m_index++] = c;
+	       m_crc = crc8(m_crc, c);
+	       if (m_index == m_length) {
+		  m_state = CHECK;
+	       }
+	       return false;
+
+	    case CHECK:
+	       m_state = IDLE;
+	       if (c != m_crc) {
+		  m_errors++;
+		  return false;
+	       }
+	       m_payload[m_length] = 0;
+	       return true;
+	 }
+	 return false;
+      };
+
+      uint8_t type() {
+	 return m_type;
+      };
+
+      uint8_t length() {
+	 return m_length;
+      };
+
+      const uint8_t *payload() {
+	 return m_payload;
+      };
+
+      uint8_t errors() {
+	 return m_errors;
+      };
+
+   private:
+      enum {
+	 IDLE,
+	 TYPE,
+	 LENGTH,
+	 PAYLOAD,
+	 CHECK
+      } m_state;
+
+      uint8_t m_type;
+      uint8_t m_length;
+      uint8_t m_index;
+      uint8_t m_crc;
+      uint8_t m_errors;
+      uint8_t m_payload[SIZE + 1];
+};
+
+
+/*
+ * Bounded queue of outgoing bytes.
+ *
+ * Every call to ble_write() is a separate transaction with the
+ * nRF8001, and a fast spin of the wheel can issue dozens of them in
+ * one tick, flooding the ACI command channel. Instead, controllers
+ * put() their commands here, and drain() is called once per loop().
+ * It packs the queued bytes into packets of up to BLE_PACKET_SIZE,
+ * and sends at most BUDGET packets per INTERVAL milliseconds; the
+ * remainder waits for the next interval.
+ *
+ * put() is all-or-nothing, so a multi-byte command is never split
+ * by an overflow. Bytes that don't fit are dropped and counted in
+ * dropped().
+ */
+template <
+   uint8_t SIZE,
+   uint8_t BUDGET,
+   uint8_t INTERVAL
+>
+class TxQueue {
+   public:
+      TxQueue() :
+	 m_front(0),
+	 m_count(0),
+	 m_credit(BUDGET),
+	 m_dropped(0),
+	 m_refilled(0) {
+      };
+
+      boolean put(uint8_t c) {
+	 return put(&c, 1);
+      };
+
+      boolean put(const uint8_t *data, uint8_t length) {
+	 if (length > SIZE - m_count) {
+	    m_dropped += length;
+	    return false;
+	 }
+
+	 for (uint8_t i = 0; i < length; i++) {
+	    m_queue[(m_front + m_count) % SIZE] = data[i];
+	    m_count++;
+	 }
+	 return true;
+      };
+
+      // Queues a binary frame. Like put(), either the whole frame is
+      // queued or none of it is.
+      boolean put_frame(uint8_t type, const uint8_t *payload, uint8_t length) {
+	 uint8_t header[] = {FRAME_START, type, length};
+	 uint8_t crc = crc8(crc8(0, type), length);
+
+	 if (length + 4 > SIZE - m_count) {
+	    m_dropped += length + 4;
+	    return false;
+	 }
+
+	 for (uint8_t i = 0; i < length; i++) {
+	    crc = crc8(crc, payload[i]);
+	 }
+
+	 put(header, sizeof(header));
+	 put(payload, length);
+	 put(crc);
+	 return true;
+      };
+
+      void drain() {
+	 if ((unsigned long) (millis() - m_refilled) >= INTERVAL) {
+	    m_credit = BUDGET;
+	    m_refilled = millis();
+	 }
+
+	 while (m_count && m_credit) {
+	    uint8_t packet[BLE_PACKET_SIZE];
+	    uint8_t n = 0;
+
+	    while (m_count && n < BLE_PACKET_SIZE) {
+	       packet[n++] = m_queue[m_front];
+	       m_front = (m_front + 1) % SIZE;
+	       m_count--;
+	    }
+
+	    ble_write_bytes(packet, n);
+	    m_credit--;
+	 }
+      };
+
+      // Discards anything queued, e.g. when the link goes down.
+      void clear() {
+	 m_count = 0;
+      };
+
+      uint8_t count() {
+	 return m_count;
+      };
+
+      // Bytes which put() would accept.
+      uint8_t space() {
+	 return SIZE - m_count;
+      };
+
+      uint16_t dropped() {
+	 return m_dropped;
+      };
+
+   private:
+      uint8_t m_queue[SIZE];
+      uint8_t m_front;
+      uint8_t m_count;
+      uint8_t m_credit;
+      uint16_t m_dropped;
+      unsigned long m_refilled;
+};
+
+#endif
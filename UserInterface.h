@@ -34,7 +34,8 @@
  *
  *  For polling InputSources, you must poll them in loop()
  *  before calling UI::loop(). For Interrupt-driven sources, the
- *  events are inserted into the queue automatically.
+ *  events are inserted into the queue automatically, through
+ *  UI::put_isr().
  *
  * Screens
  *
@@ -47,15 +48,37 @@
  *
  *  Controllers can be used to handle user input. They abstract away
  *  the details of handling certain patterns of events.
+ *
+ * Tasks
+ *
+ *  The sketch's loop() can be a Scheduler, which runs polling,
+ *  communication, UI::loop() and so on as Tasks, each with a period
+ *  and a time budget. The CPU sleeps whenever no task is due.
  */
 
 #ifndef USER_INTERFACE_H
 #define USER_INTERFACE_H
 
+#include <avr/sleep.h>
 #include <Adafruit_GFX.h>
+#include "Font5x7.h"
+#include "Log.h"
+#include "Profile.h"
 
 const int SIZE = 8;
 
+/*
+ * Marks a PROGMEM string as one, for functions which take F()
+ * strings. F() itself only works inside a function, so strings for
+ * views declared at file scope are defined separately:
+ *
+ *   const char s_hello[] PROGMEM = "Hello";
+ *   Label g_hello(flash(s_hello));
+ */
+inline const __FlashStringHelper *flash(PGM_P str) {
+   return reinterpret_cast<const __FlashStringHelper *>(str);
+}
+
 /*
  * Forward declare UI class. We need it in a few places.
  */
@@ -79,48 +102,130 @@ struct Event
 Event null_event = {0, 0, 0};
 
 /*
- * A place to buffer input events for further processing 
+ * A place to buffer input events for further processing.
+ *
+ * The queue has a single producer and a single consumer, which may
+ * be an interrupt handler and loop() respectively, and needs no
+ * critical section. The producer only ever writes m_back and the
+ * consumer only m_front. Both are free-running byte counters, read
+ * and written atomically, whose difference is the number of queued
+ * events; SIZE must divide 256 for that to work.
+ *
+ * Events which don't fit are dropped and counted. Relative events,
+ * such as wheel movement, are put with put_relative(): while the
+ * newest queued event is a relative event from the same source, the
+ * new delta is added to it rather than taking another slot, so a fast
+ * spin can't crowd out button events. The newest event is never
+ * merged into while it is also the oldest, since the consumer may be
+ * in the middle of reading it.
  */
 class EventQueue {
    public:
-      EventQueue() {
-	 m_front = 0;
-	 m_back = 0;
-	 m_count = 0;
+      EventQueue() :
+	 m_front(0),
+	 m_back(0),
+	 m_relative(false),
+	 m_high_water(0),
+	 m_dropped(0) {
       };
 
-      void put(unsigned char source, unsigned char data) {
-	 if (m_count < SIZE) {
-	    m_queue[m_back].time = millis();
-	    m_queue[m_back].source = source;
-	    m_queue[m_back].data = data;
-	    m_back = (m_back + 1) % SIZE;
-	    m_count++;
+      boolean put(unsigned char source, unsigned char data) {
+	 return put(millis(), source, data);
+      };
+
+      boolean put(unsigned long time,
+		  unsigned char source,
+		  unsigned char data) {
+	 unsigned char back = m_back;
+	 unsigned char count = back - m_front;
+
+	 if (count >= SIZE) {
+	    m_dropped++;
+	    return false;
 	 }
+
+	 Slot &slot = m_queue[back % SIZE];
+	 slot.time = time;
+	 slot.source = source;
+	 slot.data = data;
+	 m_relative = false;
+	 m_back = back + 1;
+
+	 if (count + 1 > m_high_water) {
+	    m_high_water = count + 1;
+	 }
+	 return true;
       };
 
-      Event& get() {
-	 if (m_count > 0) {
-	    unsigned char idx = m_front;
-	    m_front = (m_front + 1) % SIZE;
-	    m_count--;
-      
-	    return m_queue[idx];
+      // Puts a signed delta, merging it into the newest event if
+      // possible.
+      boolean put_relative(unsigned char source, char delta) {
+	 unsigned char back = m_back;
+
+	 if (m_relative && (unsigned char) (back - m_front) > 1) {
+	    Slot &tail = m_queue[(unsigned char) (back - 1) % SIZE];
+	    int sum = (char) tail.data + delta;
+
+	    if (tail.source == source && sum >= -128 && sum <= 127) {
+	       tail.data = sum;
+	       return true;
+	    }
 	 }
-    
-	 return (Event &) null_event;
+
+	 if (put(source, delta)) {
+	    m_relative = true;
+	    return true;
+	 }
+	 return false;
       };
-  
+
+      // Returns null_event if the queue is empty.
+      Event get() {
+	 unsigned char front = m_front;
+	 Event event = null_event;
+
+	 if (front != m_back) {
+	    const Slot &slot = m_queue[front % SIZE];
+	    event.time = slot.time;
+	    event.source = slot.source;
+	    event.data = slot.data;
+	    m_front = front + 1;
+	 }
+	 return event;
+      };
+
       unsigned char count() {
-	 return m_count;
+	 return m_back - m_front;
       };
-  
+
+      // The most events which have been queued at once.
+      unsigned char high_water() {
+	 return m_high_water;
+      };
+
+      // Read from the consumer, this can be torn; it is only meant
+      // for diagnostics.
+      unsigned int dropped() {
+	 return m_dropped;
+      };
+
    private:
-      unsigned char m_front;
-      unsigned char m_back;
-      unsigned char m_count;
+      // Event, but with volatile fields.
+      struct Slot {
+	 volatile unsigned long time;
+	 volatile unsigned char source;
+	 volatile unsigned char data;
+      };
+
+      volatile unsigned char m_front;
+      volatile unsigned char m_back;
 
-      Event m_queue[SIZE];
+      // Producer-side state.
+      boolean m_relative;
+      unsigned char m_high_water;
+      unsigned int m_dropped;
+
+      Slot m_queue[SIZE];
 };
 
 
@@ -145,16 +250,329 @@ struct Rect {
 };
 
 
+/*
+ * The overlap of two rects, which has no area if they don't overlap.
+ */
+Rect intersect(const Rect &a, const Rect &b) {
+   uint8_t left = max(a.x, b.x);
+   uint8_t top = max(a.y, b.y);
+   int16_t right = min(a.x + a.w, b.x + b.w);
+   int16_t bottom = min(a.y + a.h, b.y + b.h);
+   Rect r = {left, top, 0, 0};
+
+   if (right > left && bottom > top) {
+      r.w = right - left;
+      r.h = bottom - top;
+   }
+   return r;
+}
+
+
+/*
+ * Displays whose framebuffer stores 8 pixel high columns as bytes,
+ * as the PCD8544 does, can implement this to draw a column of a glyph
+ * or icon in a byte or two, rather than a line or pixel at a time.
+ * See PCD8544Panel::draw_column() for what it should do.
+ */
+class ColumnWriter {
+   public:
+      virtual void draw_column(int16_t x, int16_t y,
+			       uint8_t bits, uint8_t h,
+			       uint16_t color, uint16_t bg) {};
+};
+
+
+/*
+ * What Screens draw with: the display, and a clip rect which nothing
+ * drawn through the canvas can escape.
+ *
+ * Every primitive trims itself to the clip before it reaches the
+ * display, or rejects the work entirely if none of it is visible, so
+ * a view can't spill into its neighbours and no cycles go on pixels
+ * which would be painted over anyway. Containers give each child a
+ * canvas of its own, clipped to the intersection of the child's
+ * bounds and their own clip; this is cheap, as a canvas is just a
+ * reference and a rect.
+ *
+ * Text is printed through the canvas too. Characters which fit the
+ * clip entirely are passed to the display's own write(), so a display
+ * with a fast text path keeps it; characters on the edge of the clip
+ * are drawn a glyph column at a time. Lines wrap, if wrapping is on,
+ * at the right edge of the clip, back to the x given to setCursor().
+ *
+ * Given the display's ColumnWriter, columns are drawn through it,
+ * with the bits outside the clip masked off.
+ */
+class Canvas : public Print {
+   public:
+      Canvas(Adafruit_GFX &display, const Rect &clip,
+	     ColumnWriter *columns = 0) :
+	 m_display(display),
+	 m_columns(columns),
+	 m_clip(clip),
+	 m_wrap(true)
+      {
+	 setCursor(clip.x, clip.y);
+      };
+
+      Canvas(Canvas &parent, const Rect &clip) :
+	 m_display(parent.m_display),
+	 m_columns(parent.m_columns),
+	 m_clip(intersect(parent.m_clip, clip)),
+	 m_wrap(true)
+      {
+	 setCursor(clip.x, clip.y);
+      };
+
+      const Rect &clip() {
+	 return m_clip;
+      };
+
+      boolean empty() {
+	 return !m_clip.w;
+      };
+
+      void fillRect(int16_t x, int16_t y, int16_t w, int16_t h,
+		    uint16_t color) {
+	 int16_t left = max(x, m_clip.x);
+	 int16_t top = max(y, m_clip.y);
+	 int16_t right = min(x + w, m_clip.x + m_clip.w);
+	 int16_t bottom = min(y + h, m_clip.y + m_clip.h);
+
+	 if (right > left && bottom > top) {
+	    m_display.fillRect(left, top, right - left, bottom - top, color);
+	 }
+      };
+
+      void drawFastVLine(int16_t x, int16_t y, int16_t h, uint16_t color) {
+	 fillRect(x, y, 1, h, color);
+      };
+
+      void drawFastHLine(int16_t x, int16_t y, int16_t w, uint16_t color) {
+	 fillRect(x, y, w, 1, color);
+      };
+
+      void drawPixel(int16_t x, int16_t y, uint16_t color) {
+	 if (contains(x, y)) {
+	    m_display.drawPixel(x, y, color);
+	 }
+      };
+
+      // Draws the set bits of a column of up to 8 pixels, least
+      // significant at the top, as in Font5x7.h.
+      void drawColumn(int16_t x, int16_t y, uint8_t bits, uint8_t h,
+		      uint16_t color) {
+	 if (x < m_clip.x || x >= m_clip.x + m_clip.w) {
+	    return;
+	 }
+
+	 if (m_columns) {
+	    int16_t top = m_clip.y - y;
+	    int16_t bottom = m_clip.y + m_clip.h - y;
+
+	    if (top > 0) {
+	       bits = top < 8 ? bits & (0xff << top) : 0;
+	    }
+	    if (bottom < 8) {
+	       bits = bottom > 0 ? bits & ((1 << bottom) - 1) : 0;
+	    }
+	    if (bits) {
+	       m_columns->draw_column(x, y, bits, h, color, color);
+	    }
+	    return;
+	 }
+
+	 for (int8_t i = 0; i < h; i++) {
+	    if (!(bits & (1 << i))) {
+	       continue;
+	    }
+
+	    int8_t start = i;
+	    while (i < h && (bits & (1 << i))) {
+	       i++;
+	    }
+	    drawFastVLine(x, y + start, i - start, color);
+	 }
+      };
+
+      void setCursor(int16_t x, int16_t y) {
+	 m_cursor_x = m_margin = x;
+	 m_cursor_y = y;
+      };
+
+      void setTextWrap(boolean wrap) {
+	 m_wrap = wrap;
+      };
+
+      size_t write(uint8_t c) {
+	 if (c == '\n') {
+	    m_cursor_x = m_margin;
+	    m_cursor_y += 8;
+	    return 1;
+	 } else if (c == '\r') {
+	    return 1;
+	 }
+
+	 if (m_wrap &&
+	     m_cursor_x + CHAR_WIDTH > m_clip.x + m_clip.w &&
+	     m_cursor_x > m_margin) {
+	    m_cursor_x = m_margin;
+	    m_cursor_y += 8;
+	 }
+
+	 if (contains(m_cursor_x, m_cursor_y) &&
+	     contains(m_cursor_x + CHAR_WIDTH - 1, m_cursor_y + 7)) {
+	    m_display.setCursor(m_cursor_x, m_cursor_y);
+	    m_display.write(c);
+	 } else {
+	    const uint8_t *bitmap = glyph(c);
+	    for (uint8_t i = 0; i < GLYPH_WIDTH; i++) {
+	       drawColumn(m_cursor_x + i, m_cursor_y,
+			  pgm_read_byte(bitmap + i), 8, BLACK);
+	    }
+	 }
+
+	 m_cursor_x += CHAR_WIDTH;
+	 return 1;
+      };
+
+      using Print::write;
+
+   private:
+      boolean contains(int16_t x, int16_t y) {
+	 return
+	    x >= m_clip.x && x < m_clip.x + m_clip.w &&
+	    y >= m_clip.y && y < m_clip.y + m_clip.h;
+      };
+
+      Adafruit_GFX &m_display;
+      ColumnWriter *m_columns;
+      const Rect m_clip;
+      int16_t m_cursor_x;
+      int16_t m_cursor_y;
+      int16_t m_margin;
+      boolean m_wrap;
+};
+
+
+/*
+ * Receives the regions of the screen which UI::loop() repainted during
+ * a tick. Displays which keep a local framebuffer can implement this
+ * to transfer only the damaged parts of it to the hardware.
+ */
+class DamageListener {
+   public:
+      virtual void damage(const Rect &where) {};
+};
+
+/*
+ * Used when the display has no use for damage information.
+ */
+DamageListener null_damage;
+
+
+/*
+ * Base class for anything which views can poll for changes. Instances
+ * link themselves into a global list when they are constructed, so
+ * that UI::loop() can clear every dirty flag at the end of the tick
+ * without the sketch having to enumerate them. This means instances
+ * must be allocated statically, which is what we do anyway.
+ */
+class DirtyFlag {
+   public:
+      DirtyFlag() :
+	 m_dirty(false),
+	 m_next(s_head)
+      {
+	 s_head = this;
+      };
+
+      boolean dirty() {
+	 return m_dirty;
+      };
+
+      void reset() {
+	 m_dirty = false;
+      };
+
+      // Marks the flag dirty without going through update(). Useful
+      // when a value is modified in place.
+      void touch() {
+	 m_dirty = true;
+      };
+
+      static void reset_all() {
+	 for (DirtyFlag *i = s_head; i; i = i->m_next) {
+	    i->reset();
+	 }
+      };
+
+      // True if any flag at all is dirty.
+      static boolean any() {
+	 for (DirtyFlag *i = s_head; i; i = i->m_next) {
+	    if (i->m_dirty) {
+	       return true;
+	    }
+	 }
+	 return false;
+      };
+
+   protected:
+      boolean m_dirty;
+
+   private:
+      DirtyFlag *m_next;
+      static DirtyFlag *s_head;
+};
+
+DirtyFlag *DirtyFlag::s_head = 0;
+
+
 /*
  * Like a Window in a desktop system, but devoted to the entire
  * screen. A Screen receives a stream of events, and knows how to draw
  * itself onto the display.
+ *
+ * Screens draw through a Canvas, clipped to their bounds.
+ *
+ * Screens are not redrawn unconditionally. Each tick, UI::loop() calls
+ * redraw(), which repaints the screen only if dirty() reports that
+ * something it depends on has changed. Screens which depend on
+ * models should forward the models' dirty flags; screens which
+ * animate should report dirty when their appearance would change,
+ * and report animated() while they do, so that the sketch keeps
+ * redrawing them on time. Static screens need not override dirty()
+ * at all: they are painted whenever their container is repainted.
  */
 class Screen {
    public:
       Screen() {};
-      virtual void draw (Adafruit_GFX &display, const Rect &where) {};
+      virtual void draw (Canvas &canvas, const Rect &where) {};
       virtual void handle_event(UI& ui, Event &) {};
+
+      virtual boolean dirty() {
+	 return false;
+      };
+
+      // True while the screen changes by itself, with time rather
+      // than with its models.
+      virtual boolean animated() {
+	 return false;
+      };
+
+      // Containers override this to redraw only their dirty children.
+      virtual void redraw(UI &ui,
+			  Canvas &canvas,
+			  const Rect &where) {
+	 if (dirty()) {
+	    repaint(ui, canvas, where);
+	 }
+      };
+
+      // Clears the bounds rect and draws into it unconditionally,
+      // clipped to it. The visible part of the rect is reported to
+      // the UI as damaged.
+      void repaint(UI &ui, Canvas &canvas, const Rect &where);
 };
 
 
@@ -169,15 +587,22 @@ class TestScreen : public Screen {
 	 /* nothing to be done for now */
       };
    
-      void draw(Adafruit_GFX &display, const Rect &where) {
-	 display.println(String("Time:") + last_event.time);
-	 display.println(String("Src: ") + last_event.source);
-	 display.println(String("Data: ") + last_event.data);
+      void draw(Canvas &canvas, const Rect &where) {
+	 canvas.print(F("Time:"));
+	 canvas.println(last_event.time);
+	 canvas.print(F("Src: "));
+	 canvas.println(last_event.source);
+	 canvas.print(F("Data: "));
+	 canvas.println(last_event.data);
       }
   
       void handle_event(UI& ui, Event &event) {
 	 last_event = event;
       }
+
+      boolean dirty() {
+	 return true;
+      };
   
    private:  
       Event & last_event;
@@ -200,7 +625,8 @@ class ScreenStack : public Screen {
       ScreenStack(Screen &home, uint8_t id) :
 	 m_top(m_screens),
 	 m_end(m_screens + SIZE + 1),
-	 m_id(id)
+	 m_id(id),
+	 m_changed(true)
       {
 	 m_screens[0] = &home;
       };
@@ -209,19 +635,40 @@ class ScreenStack : public Screen {
 	 if (m_top < m_end) {
 	    m_top++;
 	    *m_top = &screen;
+	    m_changed = true;
 	 } else {
-	    Serial.println("Error: Screen Stack Full");
+	    log_error(F("Screen Stack Full"));
 	 }
       };
 
       void pop() {
 	 if (m_top > m_screens) {
 	    m_top--;
+	    m_changed = true;
 	 }
       };
 
-      void draw(Adafruit_GFX &display, const Rect &where) {
-	 (*m_top)->draw(display, where);
+      void draw(Canvas &canvas, const Rect &where) {
+	 (*m_top)->draw(canvas, where);
+      };
+
+      boolean dirty() {
+	 return m_changed || (*m_top)->dirty();
+      };
+
+      boolean animated() {
+	 return (*m_top)->animated();
+      };
+
+      // The top screen is repainted from scratch whenever it changes,
+      // since nothing on the display belongs to it yet.
+      void redraw(UI &ui, Canvas &canvas, const Rect &where) {
+	 if (m_changed) {
+	    (*m_top)->repaint(ui, canvas, where);
+	    m_changed = false;
+	 } else {
+	    (*m_top)->redraw(ui, canvas, where);
+	 }
       };
 
       void handle_event(UI &ui, Event &event) {
@@ -238,6 +685,7 @@ class ScreenStack : public Screen {
       Screen **m_top;
       Screen **m_end;
       uint8_t m_id;
+      boolean m_changed;
 };
 
 
@@ -247,13 +695,23 @@ class ScreenStack : public Screen {
  * the top level of your sketch. Then you should call its loop method
  * from loop().
  *
- * Events are injected with put().
+ * Events are injected with put(), or with put_isr() from interrupt
+ * handlers.
+ *
+ * If the display can make use of it, pass a DamageListener, which
+ * will be told about every region repainted by loop(), and a
+ * ColumnWriter, which canvases will draw columns through.
  */
 class UI {
    public:
-      UI(Adafruit_GFX& display, Screen &home):
+      UI(Adafruit_GFX& display,
+	 Screen &home,
+	 DamageListener &damage = null_damage,
+	 ColumnWriter *columns = 0):
 	 m_stack(home, 255),
-	 m_display(display)
+	 m_display(display),
+	 m_damage(damage),
+	 m_columns(columns)
       {
 	 m_rect.x = 0;
 	 m_rect.y = 0;
@@ -269,27 +727,290 @@ class UI {
 	 m_stack.pop();
       };
     
-      void loop() {
-	 while (m_queue.count()) {
-	    m_stack.handle_event(*this, m_queue.get());
+      // Dispatches pending events, then redraws only the views whose
+      // models changed, and finally clears all dirty flags so that
+      // the next tick starts clean. Returns false if nothing
+      // happened: no events, and no model changed. Redrawing an
+      // animation doesn't count; see animated().
+      boolean loop() {
+	 boolean busy = pending() || DirtyFlag::any();
+
+	 {
+	    PROFILE_SCOPE(PROFILE_DISPATCH);
+	    while (m_isr_queue.count()) {
+	       Event event = m_isr_queue.get();
+	       m_stack.handle_event(*this, event);
+	    }
+	    while (m_queue.count()) {
+	       Event event = m_queue.get();
+	       m_stack.handle_event(*this, event);
+	    }
 	 }
-	 m_stack.draw(m_display, m_rect);
+	 {
+	    PROFILE_SCOPE(PROFILE_REDRAW);
+	    Canvas canvas(m_display, m_rect, m_columns);
+	    m_stack.redraw(*this, canvas, m_rect);
+	 }
+	 DirtyFlag::reset_all();
+	 return busy;
+      };
+
+      // True while the screen shown is animated, and so needs
+      // redrawing every tick even when nothing is happening.
+      boolean animated() {
+	 return m_stack.animated();
+      };
+
+      // True while events are waiting to be dispatched.
+      boolean pending() {
+	 return m_queue.count() || m_isr_queue.count();
       };
 
       void put(unsigned char source, unsigned char data) {
 	 m_queue.put(source, data);
       };
+
+      void put_relative(unsigned char source, char delta) {
+	 m_queue.put_relative(source, delta);
+      };
+
+      // The interrupt-safe counterpart of put(). Events put here are
+      // dispatched ahead of those from polled sources.
+      boolean put_isr(unsigned long time,
+		      unsigned char source,
+		      unsigned char data) {
+	 return m_isr_queue.put(time, source, data);
+      };
+
+      // Events dropped because a queue was full.
+      unsigned int dropped() {
+	 return m_queue.dropped() + m_isr_queue.dropped();
+      };
+
+      unsigned char high_water() {
+	 return max(m_queue.high_water(), m_isr_queue.high_water());
+      };
+
+      void damage(const Rect &where) {
+	 m_damage.damage(where);
+      };
     
    private:
       // I don't really like coupling the screen stack to this class,
       // but it's expedient for the time being.
       ScreenStack<10> m_stack;
       Adafruit_GFX& m_display;
+      DamageListener &m_damage;
+      ColumnWriter *m_columns;
       EventQueue m_queue;
+      EventQueue m_isr_queue;
       Rect m_rect;
 };
 
 
+void Screen::repaint(UI &ui, Canvas &canvas, const Rect &where) {
+   Canvas clipped(canvas, where);
+
+   if (clipped.empty()) {
+      return;
+   }
+
+   clipped.fillRect(where.x, where.y, where.w, where.h, WHITE);
+   draw(clipped, where);
+   ui.damage(clipped.clip());
+}
+
+
+class Task;
+
+typedef void (*TaskFunction)(Task &task);
+
+/*
+ * A periodic job for the Scheduler.
+ *
+ * The function is called once every period ms, and is expected to
+ * return within budget us. Work of unbounded size, like draining an
+ * input stream, should check over_budget() as it goes, and leave the
+ * rest for the next run. Runs which take longer than the budget
+ * anyway are counted as overruns.
+ *
+ * A task may be given a longer idle period, which it runs at while
+ * the Scheduler is idle; see Scheduler::idle(). A run may call
+ * keep_pace() to have the next run come after the usual period
+ * regardless, for work such as animation, which keeps its own pace.
+ *
+ * Times are kept in 16 bits and compared by difference, so they wrap
+ * every 65 seconds without upsetting anything; periods and budgets
+ * must be under 32 seconds and 32 ms respectively.
+ */
+class Task {
+   public:
+      Task(char name,
+	   TaskFunction function,
+	   uint16_t period,
+	   uint16_t budget,
+	   uint16_t idle_period = 0) :
+	 m_name(name),
+	 m_function(function),
+	 m_period(period),
+	 m_budget(budget),
+	 m_idle_period(idle_period ? idle_period : period),
+	 m_idle(false),
+	 m_pace(false),
+	 m_next(0),
+	 m_overruns(0),
+	 m_worst(0) {
+      };
+
+      boolean over_budget() {
+	 return (uint16_t) ((uint16_t) micros() - m_started) >= m_budget;
+      };
+
+      char name() {
+	 return m_name;
+      };
+
+      // Runs which took longer than the budget.
+      uint16_t overruns() {
+	 return m_overruns;
+      };
+
+      // The longest run so far, in us.
+      uint16_t worst() {
+	 return m_worst;
+      };
+
+      // Makes the task due now, whatever its period.
+      void wake() {
+	 m_next = millis();
+      };
+
+      // Runs the task next after its usual period, even if idle.
+      void keep_pace() {
+	 m_pace = true;
+      };
+
+   private:
+      boolean due(uint16_t now) {
+	 return (int16_t) (now - m_next) >= 0;
+      };
+
+      uint16_t period() {
+	 return m_idle && !m_pace ? m_idle_period : m_period;
+      };
+
+      void run(uint16_t now) {
+	 m_started = micros();
+	 m_function(*this);
+
+	 uint16_t elapsed = (uint16_t) micros() - m_started;
+	 if (elapsed > m_worst) {
+	    m_worst = elapsed;
+	 }
+	 if (elapsed > m_budget) {
+	    m_overruns++;
+	    log_info(F("overrun "), m_name, elapsed);
+	 }
+
+	 // If we've fallen more than a period behind, skip the missed
+	 // runs rather than trying to catch up.
+	 m_next += period();
+	 if (due(now)) {
+	    m_next = now + period();
+	 }
+	 m_pace = false;
+      };
+
+      const char m_name;
+      const TaskFunction m_function;
+      const uint16_t m_period;
+      const uint16_t m_budget;
+      const uint16_t m_idle_period;
+      boolean m_idle;
+      boolean m_pace;
+      uint16_t m_next;
+      uint16_t m_started;
+      uint16_t m_overruns;
+      uint16_t m_worst;
+
+      template <uint8_t N> friend class Scheduler;
+};
+
+
+/*
+ * A static cooperative scheduler. Tasks are listed in order of
+ * priority, highest first, and run() runs every task which is due.
+ * After each task it starts again from the top, so a task can only be
+ * held up by a single run of a lower priority one: with input polling
+ * first, a burst of work elsewhere delays it by at most one budget.
+ *
+ * Once no task is due, run() puts the CPU to sleep until the next
+ * interrupt. The peripherals keep running in idle sleep, so that is
+ * at the latest the timer tick behind millis(), under a millisecond
+ * away; before then it may be a pin change, or the radio or a UART
+ * needing service. Interrupt handlers run as usual, and run() returns
+ * once the CPU wakes.
+ *
+ * Waking every millisecond only to find nothing due still costs
+ * power, so when the sketch finds nothing happening it can call
+ * idle(true), which puts every task on its longer idle period.
+ *
+ * Call run() from loop(). Every period must be at least 1 ms, or
+ * run() never returns.
+ */
+template <uint8_t N>
+class Scheduler {
+   public:
+      Scheduler(Task *const (&tasks)[N]) :
+	 m_tasks(tasks),
+	 m_idle(false) {
+      };
+
+      void run() {
+	 uint8_t i = 0;
+
+	 while (i < N) {
+	    uint16_t now = millis();
+
+	    if (m_tasks[i]->due(now)) {
+	       m_tasks[i]->run(now);
+	       i = 0;
+	    } else {
+	       i++;
+	    }
+	 }
+
+	 set_sleep_mode(SLEEP_MODE_IDLE);
+	 sleep_mode();
+      };
+
+      // Switches the tasks to their idle periods, or back. Leaving
+      // idle makes every task due at once, so that whatever ended it
+      // is handled, and shown, without waiting out an idle period.
+      void idle(boolean idle) {
+	 if (idle == m_idle) {
+	    return;
+	 }
+
+	 m_idle = idle;
+	 for (uint8_t i = 0; i < N; i++) {
+	    m_tasks[i]->m_idle = idle;
+	    if (!idle) {
+	       m_tasks[i]->wake();
+	    }
+	 }
+      };
+
+      boolean idle() {
+	 return m_idle;
+      };
+
+   private:
+      Task *const (&m_tasks)[N];
+      boolean m_idle;
+};
+
+
 #endif
 
 
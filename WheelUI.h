@@ -13,6 +13,8 @@
 #include <AdaEncoder.h>
 #include "UserInterface.h"
 #include "MVC.h"
+#include "Fixed.h"
+#include "Font5x7.h"
 
 
 /*
@@ -63,31 +65,51 @@ typedef enum {
    BUTTON_RELEASE, // raw button-relase event
    CLICK,          // high-level click event
    HOLD,           // high-level hold event
+   REPEAT,         // high-level event, repeated while held
+   DOUBLE_CLICK,   // high-level event, follows a second CLICK
 } EventType;
 
 #define CLICK_THRESHOLD 1000
+#define REPEAT_INTERVAL 250
+#define DOUBLE_CLICK_INTERVAL 300
 
 
 /*
  * A screen screen which displays static text.
+ *
+ * Give it the text with F(), and it stays in flash and is printed
+ * from there, rather than taking up RAM for as long as the sketch
+ * runs.
  */
 class Label : public Screen {
 
    public:
       Label(const char *text, boolean wrap=true) : 
 	 m_text(text),
-	 m_wrap(wrap) {
+	 m_wrap(wrap),
+	 m_flash(false) {
+      };
+
+      Label(const __FlashStringHelper *text, boolean wrap=true) :
+	 m_text((const char *) text),
+	 m_wrap(wrap),
+	 m_flash(true) {
       };
 
-      void draw(Adafruit_GFX &display, const Rect &where) {
-	 display.setTextWrap(m_wrap);
-	 display.setCursor(where.x, where.y);
-	 display.println(m_text);
+      void draw(Canvas &canvas, const Rect &where) {
+	 canvas.setTextWrap(m_wrap);
+	 canvas.setCursor(where.x, where.y);
+	 if (m_flash) {
+	    canvas.print((const __FlashStringHelper *) m_text);
+	 } else {
+	    canvas.print(m_text);
+	 }
       };
 
    private:
       const char *m_text;
       boolean m_wrap;
+      boolean m_flash;
 };
 
 
@@ -106,39 +128,37 @@ class RangeView : public Screen {
       m_max(max) {
     };
 
-    void draw(Adafruit_GFX &display, const Rect &where) {
-      uint8_t 
-	x1 = where.x,
-	y1 = where.y + where.h,
-	x2 = where.x + where.w,
-	y2 = y1,
-	x3 = x2,
-	y3 = where.y,
-	 tfill = (where.w * (m_model.value() - m_min)) / (m_max - m_min);
-
-      // Draw a triangle outline that "fills up" according to the
-      // volume level. I.e. at 0 volume, it's just a solid
-      // outline. At full volume it's completely filled.
-
-      // First, draw the filled triangle.
-      display.fillTriangle(
-	x1, y1,
-	x2, y2,
-	x3, y3,
-	BLACK);
-    
-      // Now, erase the unfilled portion of the triangle.
-      display.fillRect(
-	where.x + tfill, where.y,
-	where.w - tfill, where.h,
-	WHITE);
-
-      // now draw the outlined portion of the triangle.
-      display.drawTriangle(
-	x1, y1,
-	x2, y2,
-	x3, y3,
-	BLACK);
+    // Draws a right triangle, with its right angle at the bottom
+    // right of the rect, that "fills up" according to the value:
+    // empty, it's just an outline, and full, it's solid. The triangle
+    // is drawn a column at a time, so it stays exactly within the
+    // rect.
+    void draw(Canvas &canvas, const Rect &where) {
+      uint8_t fill = proportion(m_model.value(), m_min, m_max, where.w);
+      uint8_t bottom = where.y + where.h - 1;
+      uint8_t last_top = bottom;
+
+      for (uint8_t i = 0; i < where.w; i++) {
+	uint8_t x = where.x + i;
+	uint8_t height = where.w > 1 ?
+	  1 + (i * (where.h - 1) + (where.w - 1) / 2) / (where.w - 1) :
+	  where.h;
+	uint8_t top = bottom + 1 - height;
+
+	if (i < fill || i == where.w - 1) {
+	  canvas.drawFastVLine(x, top, height, BLACK);
+	} else {
+	  // The hypotenuse, joined up to the previous column, and the
+	  // base.
+	  canvas.drawFastVLine(x, top, max(last_top - top, 1), BLACK);
+	  canvas.drawPixel(x, bottom, BLACK);
+	}
+	last_top = top;
+      }
+    };
+
+    boolean dirty() {
+      return m_model.dirty();
     };
 
   private:
@@ -150,9 +170,18 @@ class RangeView : public Screen {
 
 /*
  * A Screen which is composed of a set of screens and controllers. It
- * is defined by a Layout. A CompositeScreen allways draws all the
- * views in the layout and always passes each event off to all the
- * controllers in the layout.
+ * is defined by a Layout. A CompositeScreen passes each event to the
+ * controllers in the layout whose routes match it. It keeps a mask
+ * of the event sources which any of them handles, built when it is
+ * constructed: most events on a screen, such as the raw press and
+ * release which accompany every click, concern no controller at all,
+ * and are rejected without looking at any of them. The controllers
+ * must therefore be constructed before the screen, which they are if
+ * they are defined above it in the sketch.
+ *
+ * When drawn from scratch it draws all the views in the layout, but
+ * on redraw() only the views which report dirty are cleared and
+ * repainted.
  */
 template
 <
@@ -161,31 +190,175 @@ template
 >
 class CompositeScreen : public Screen {
   public:
-    CompositeScreen(const Layout<N_VIEWS, N_CONTROLLERS> &layout) :
-      m_layout(layout) {
+    // With profiling enabled, the redrawing of each view i is timed
+    // as stage profile + i; see Profile.h.
+    CompositeScreen(const Layout<N_VIEWS, N_CONTROLLERS> &layout,
+		    uint8_t profile = PROFILE_NONE) :
+      m_layout(layout),
+      m_sources(0),
+      m_profile(profile) {
+      for (uint8_t i = 0; i < N_CONTROLLERS; i++) {
+	uint8_t source = m_layout.controllers[i].ref.source();
+	m_sources |= source < MASKED ? 1 << source : 1 << MASKED;
+      }
     };
 
-    void draw(Adafruit_GFX &display, const Rect &where) {
+    void draw(Canvas &canvas, const Rect &where) {
       for (uint8_t i = 0; i < N_VIEWS; i++) {
-	m_layout.views[i].ref.draw(display,
-				   m_layout.views[i].bounds);
+	const Rect &bounds = m_layout.views[i].bounds;
+	Canvas clipped(canvas, bounds);
+
+	if (!clipped.empty()) {
+	  m_layout.views[i].ref.draw(clipped, bounds);
+	}
       }
     };
 
+    // Views clip themselves to their bounds when they repaint.
+    void redraw(UI &ui, Canvas &canvas, const Rect &where) {
+      for (uint8_t i = 0; i < N_VIEWS; i++) {
+	Screen &view = m_layout.views[i].ref;
+
+	if (view.dirty()) {
+	  PROFILE_SCOPE(m_profile == PROFILE_NONE ? PROFILE_NONE :
+			m_profile + i);
+	  view.redraw(ui, canvas, m_layout.views[i].bounds);
+	}
+      }
+    };
+
+    boolean dirty() {
+      for (uint8_t i = 0; i < N_VIEWS; i++) {
+	if (m_layout.views[i].ref.dirty()) {
+	  return true;
+	}
+      }
+      return false;
+    };
+
+    boolean animated() {
+      for (uint8_t i = 0; i < N_VIEWS; i++) {
+	if (m_layout.views[i].ref.animated()) {
+	  return true;
+	}
+      }
+      return false;
+    };
+
     void handle_event(UI& ui, Event &event) {
+      if (event.source < MASKED && !(m_sources & (1 << event.source)) &&
+	  !(m_sources & (1 << MASKED))) {
+	return;
+      }
+
       for (uint8_t i = 0; i < N_CONTROLLERS; i++) {
-	m_layout.controllers[i].ref.handle_event(ui, event);
+	Controller &controller = m_layout.controllers[i].ref;
+	if (controller.routes(event)) {
+	  controller.handle_event(ui, event);
+	}
       }
     };
 
   private:
+    // Sources from MASKED up, and Controller::ANY, share the top bit.
+    static const uint8_t MASKED = 15;
+
     const Layout<N_VIEWS, N_CONTROLLERS> &m_layout;
+    uint16_t m_sources;
+    uint8_t m_profile;
+};
+
+
+/*
+ * Turns the debounced edges of a button into high-level events.
+ *
+ * A press which lasts CLICK_THRESHOLD ms produces HOLD as soon as the
+ * threshold passes, not on release, followed by REPEAT every
+ * REPEAT_INTERVAL ms for as long as the button stays down. Releasing
+ * a held button produces nothing further. A shorter press produces
+ * CLICK on release, and if it began within DOUBLE_CLICK_INTERVAL ms
+ * of the previous click's release, DOUBLE_CLICK after that. CLICK is
+ * never delayed to wait for a possible second click, so controllers
+ * which only care about clicks respond as quickly as before.
+ *
+ * The timed events need poll() to be called regularly. All times are
+ * compared by difference, so they survive millis() wrapping.
+ *
+ * Events go through UI::put_isr() if ISR is set, and UI::put()
+ * otherwise; the caller must satisfy the rules of whichever it is.
+ */
+template
+<
+   uint8_t ID,
+   boolean ISR
+>
+class Gesture {
+   public:
+      Gesture() :
+	 m_down(false),
+	 m_held(false),
+	 m_clicked(false) {};
+
+      void edge(UI &ui, unsigned long now, boolean down) {
+	 if (down) {
+	    put(ui, now, BUTTON_PRESS);
+	    m_double = m_clicked &&
+	       (unsigned long) (now - m_released) < DOUBLE_CLICK_INTERVAL;
+	    m_pressed = now;
+	    m_held = false;
+	 } else if (m_down) {
+	    put(ui, now, BUTTON_RELEASE);
+	    m_clicked = !m_held && !m_double;
+	    if (!m_held) {
+	       put(ui, now, CLICK);
+	       if (m_double) {
+		  put(ui, now, DOUBLE_CLICK);
+	       }
+	    }
+	    m_released = now;
+	 }
+	 m_down = down;
+      };
+
+      void poll(UI &ui, unsigned long now) {
+	 if (!m_down) {
+	    return;
+	 }
+
+	 if (!m_held) {
+	    if ((unsigned long) (now - m_pressed) >= CLICK_THRESHOLD) {
+	       put(ui, now, HOLD);
+	       m_held = true;
+	       m_repeated = now;
+	    }
+	 } else if ((unsigned long) (now - m_repeated) >= REPEAT_INTERVAL) {
+	    put(ui, now, REPEAT);
+	    m_repeated += REPEAT_INTERVAL;
+	 }
+      };
+
+   private:
+      void put(UI &ui, unsigned long now, EventType type) {
+	 if (ISR) {
+	    ui.put_isr(now, type, ID);
+	 } else {
+	    ui.put(type, ID);
+	 }
+      };
+
+      unsigned long m_pressed;
+      unsigned long m_released;
+      unsigned long m_repeated;
+      boolean m_down;
+      boolean m_held;
+      boolean m_clicked;  // the last release ended a single click
+      boolean m_double;   // the current press may be a double click
 };
 
 
 /*
  * An input source bound to an I/O pin. Treats the pin as a momentary
- * push-button.
+ * push-button, whose events are described in Gesture.
  */
 template
 <
@@ -197,7 +370,7 @@ template
 class ButtonSrc : PollingInputSource {
    public:
       ButtonSrc() : id(ID),
-		    m_debounce(0), 
+		    m_edge(0),
 		    m_state(INVERTED) {};
 
       void init() {
@@ -206,38 +379,110 @@ class ButtonSrc : PollingInputSource {
       };
 
       void poll(UI &ui) {
-	 if (millis() < m_debounce) {
-	    return;
+	 unsigned long now = millis();
+
+	 if ((unsigned long) (now - m_edge) >= DEBOUNCE) {
+	    boolean state = digitalRead(PIN);
+
+	    if (state != m_state) {
+	       m_gesture.edge(ui, now, INVERTED ? !state : state);
+	       m_state = state;
+	       m_edge = now;
+	    }
 	 }
 
-	 boolean state = digitalRead(PIN);
+	 m_gesture.poll(ui, now);
+      };
+
+      const uint8_t id;
+
+   private:
+      static const uint8_t DEBOUNCE = 100;
+
+      Gesture<ID, false> m_gesture;
+      unsigned long m_edge;
+      boolean m_state;
+};
+
+
+/*
+ * An interrupt-driven counterpart of ButtonSrc, for pins which can
+ * raise pin-change interrupts.
+ *
+ * ButtonSrc only notices a press when loop() gets around to polling
+ * it, which can be a long time during a BLE transfer or a full panel
+ * flush. This source samples the pin in the interrupt handler instead,
+ * and puts the events with the time of the edge through
+ * UI::put_isr().
+ *
+ * The first edge is reported immediately. Contact bounce is ignored
+ * for DEBOUNCE ms after an accepted edge, without blocking anything:
+ * poll() then compares the settled pin with the last reported state,
+ * and reports the difference if the edge which ended the bounce was
+ * ignored. It must still be called from loop(), but it is cheap; it
+ * also times the HOLD and REPEAT events described in Gesture.
+ */
+template
+<
+   uint8_t PIN,
+   uint8_t MODE,
+   uint8_t ID,
+   boolean INVERTED
+>
+class InterruptButtonSrc : public CallBackInterface {
+   public:
+      InterruptButtonSrc() : id(ID),
+			     m_ui(0),
+			     m_edge(0),
+			     m_state(INVERTED) {};
+
+      void init(UI &ui) {
+	 m_ui = &ui;
+	 pinMode(PIN, MODE);
+	 m_state = digitalRead(PIN);
+	 PCintPort::attachInterrupt(PIN, this, CHANGE);
+      };
+
+      // Called by ooPinChangeInt, in interrupt context.
+      void cbmPCInt(int8_t pin) {
+	 unsigned long now = millis();
+
+	 if ((unsigned long) (now - m_edge) >= DEBOUNCE) {
+	    sample(now);
+	 }
+      };
 
-	 if (state != m_state) {
-	    put(ui, INVERTED ? !state : state);
-	    m_state = state;
-	    m_debounce = millis() + 100;
+      void poll(UI &ui) {
+	 unsigned long now = millis();
+
+	 noInterrupts();
+	 if ((unsigned long) (now - m_edge) >= DEBOUNCE) {
+	    sample(now);
 	 }
+	 m_gesture.poll(ui, now);
+	 interrupts();
       };
 
       const uint8_t id;
 
    private:
-      void put(UI &ui, boolean state) {
-	 if (state) {
-	    ui.put(BUTTON_PRESS, ID);
-	    m_pressed = millis();
-	 } else {
-	    ui.put(BUTTON_RELEASE, ID);
-	    if (millis() > m_pressed + CLICK_THRESHOLD) {
-	       ui.put(HOLD, ID);
-	    } else {
-	       ui.put(CLICK, ID);
-	    }
+      static const uint8_t DEBOUNCE = 20;
+
+      // Interrupts must be disabled.
+      void sample(unsigned long now) {
+	 boolean state = digitalRead(PIN);
+
+	 if (state == m_state) {
+	    return;
 	 }
+	 m_state = state;
+	 m_edge = now;
+	 m_gesture.edge(*m_ui, now, INVERTED ? !state : state);
       };
 
-      unsigned long m_pressed;
-      unsigned long m_debounce;
+      UI *m_ui;
+      Gesture<ID, true> m_gesture;
+      unsigned long m_edge;
       boolean m_state;
 };
 
@@ -259,7 +504,7 @@ class EncoderSrc : public PollingInputSource {
 
     void poll(UI &ui) {
       if (m_encoder.getClicks()) {
-	ui.put(ID, m_encoder.query());
+	ui.put_relative(ID, m_encoder.query());
       }
     };
 
@@ -273,29 +518,79 @@ class EncoderSrc : public PollingInputSource {
 /*
  * Displays a line of text larger than the screen by scrolling it
  * horizontally.
+ *
+ * Text is not laid out with print(). The text is its own compact
+ * strip: column x of the rendered line is one glyph byte, looked up
+ * from the string and Font5x7.h, so draw() blits only the columns
+ * which fall inside its rect, and nothing is drawn off-screen. Long
+ * text scrolls left one pixel every SCROLL_MS, wrapping around after
+ * a gap.
+ *
+ * The view is dirty when its model changes, and, while the text is
+ * too long to fit, whenever the scroll offset advances; it is then
+ * animated(). Short text is only redrawn when it changes.
  */
 
 class ScrolledText : public Screen {
   public:
-    ScrolledText(const char *text) : m_text(text) {};
+    ScrolledText(Model<const char *> &model) :
+      m_model(model),
+      m_scrolling(false),
+      m_start(0),
+      m_period(1),
+      m_offset(0) {};
     
-    void draw(Adafruit_GFX &display, const Rect &where) {
-      display.setTextWrap(false);
-      display.setTextSize(1);
-
-      if (strlen(m_text) > (where.w) / 6) {
-	uint8_t w = where.w;
-	uint8_t m = w / 5;
-	display.setCursor(w - ((millis() / 1000) % m) * 20, where.y);
-	display.print(m_text);
-      } else {
-	display.setCursor(0, where.y);
-	display.print(m_text);
+    void draw(Canvas &canvas, const Rect &where) {
+      const char *text = m_model.value();
+      unsigned int width = strlen(text) * CHAR_WIDTH;
+
+      // New text scrolls from its start.
+      if (m_model.dirty()) {
+	m_start = millis();
       }
+
+      m_scrolling = width > where.w;
+      m_period = width + GAP;
+      m_offset = m_scrolling ? offset() : 0;
+
+      for (uint8_t x = 0; x < where.w; x++) {
+	unsigned int column = (m_offset + x) % m_period;
+
+	if (column < width) {
+	  canvas.drawColumn(where.x + x, where.y,
+			    text_column(text, column),
+			    min(where.h, 8),
+			    BLACK);
+	} else if (!m_scrolling) {
+	  break;
+	}
+      }
+    };
+
+    boolean dirty() {
+      return m_model.dirty() || (m_scrolling && offset() != m_offset);
+    };
+
+    boolean animated() {
+      return m_scrolling;
     };
     
   private:
-    const char *m_text;
+    static const uint8_t SCROLL_MS = 50;
+    static const uint8_t GAP = 3 * CHAR_WIDTH;
+
+    // Times are compared by difference, so this survives millis()
+    // wrapping, and the offset is reduced to the period of the text
+    // before it is narrowed.
+    unsigned int offset() {
+      return (unsigned long) (millis() - m_start) / SCROLL_MS % m_period;
+    };
+
+    Model<const char *> &m_model;
+    boolean m_scrolling;
+    unsigned long m_start;
+    unsigned int m_period;
+    unsigned int m_offset;
 };
 
 
@@ -312,12 +607,9 @@ class ToggleView : public Screen {
 	 m_false(if_false) {
       };
 
-      void draw(Adafruit_GFX &display, const Rect &where) {
-	 if (m_model.value()) {
-	    m_true.draw(display, where);
-	 } else {
-	    m_false.draw(display, where);
-	 }
+      void draw(Canvas &canvas, const Rect &where) {
+	 Canvas clipped(canvas, where);
+	 active().draw(clipped, where);
       };
 
       void handle_event(UI &ui, Event &event) {
@@ -327,7 +619,32 @@ class ToggleView : public Screen {
 	    m_false.handle_event(ui, event);
 	 }
       };
+
+      boolean dirty() {
+	 return m_model.dirty() || active().dirty();
+      };
+
+      boolean animated() {
+	 return active().animated();
+      };
+
+      // When the model flips, the other view takes over the whole
+      // rect, so it must be painted from scratch.
+      void redraw(UI &ui, Canvas &canvas, const Rect &where) {
+	 Canvas clipped(canvas, where);
+
+	 if (m_model.dirty()) {
+	    active().repaint(ui, clipped, where);
+	 } else {
+	    active().redraw(ui, clipped, where);
+	 }
+      };
+
    private:
+      Screen &active() {
+	 return m_model.value() ? m_true : m_false;
+      };
+
       Model<boolean> &m_model;
       Screen &m_true;
       Screen &m_false;
@@ -336,22 +653,35 @@ class ToggleView : public Screen {
 
 /*
  * Draws an icon at the specified coordinates and dimensions.
+ *
+ * Icons are kept in program memory in the PCD8544's own layout: a
+ * bank of up to 8 rows at a time from the top, and within a bank a
+ * byte per column from the left, with the least significant bit at
+ * the top. Each byte is then a single Canvas::drawColumn(), which the
+ * panel does with a byte or two of the framebuffer.
  */
 class IconView : public Screen {
    public:
-      IconView(uint8_t w, uint8_t h, const uint8_t *data) : 
+      IconView(uint8_t w, uint8_t h, const uint8_t *data) :
 	 m_data(data),
 	 m_w(w),
 	 m_h(h) {
       };
 
-      void draw(Adafruit_GFX &display, const Rect &where) {
-	 // TODO: implement clipping according to bounds rect
-	 display.drawBitmap(
-	    where.x, where.y,
-	    m_data,
-	    m_w, m_h,
-	    BLACK);
+      void draw(Canvas &canvas, const Rect &where) {
+	 const uint8_t *p = m_data;
+
+	 for (uint8_t y = 0; y < m_h; y += 8) {
+	    uint8_t h = min(m_h - y, 8);
+
+	    for (uint8_t x = 0; x < m_w; x++) {
+	       uint8_t bits = pgm_read_byte(p++);
+
+	       if (bits) {
+		  canvas.drawColumn(where.x + x, where.y + y, bits, h, BLACK);
+	       }
+	    }
+	 }
       };
    private:
       const uint8_t *m_data;
@@ -360,6 +690,305 @@ class IconView : public Screen {
 };
 
 
+/*
+ * A 1-bit image which arrives in chunks, such as album art over BLE,
+ * and is drawn as it arrives, without a buffer for the whole image.
+ *
+ * The image is run-length encoded, row by row from the top left. Each
+ * byte is a run of up to 128 pixels: bit 7 is set for black, and bits
+ * 0-6 hold the length less one. Runs carry on from one row to the
+ * next.
+ *
+ * start() announces a new image, and put() hands over the next chunk
+ * of up to CHUNK bytes. On its next redraw the view decodes the chunk
+ * straight into the display, drawing black runs onto the white it
+ * cleared at start(), and then calls drawn(), so that whatever sends
+ * the chunks knows it can send the next. There is only ever one
+ * chunk held: put() refuses another until then, and as the image
+ * can't be finished without the chunk refused, gives up on it,
+ * calling lost(). start() calls started(), so that anything kept
+ * about the last image can be dropped.
+ *
+ * Nothing remembers what has been drawn, so if the view is repainted
+ * from scratch, say after another screen has covered it, the image
+ * is lost. It calls lost(), and the sender should start again.
+ */
+template <uint8_t CHUNK>
+class StreamedImage : public Screen {
+   public:
+      StreamedImage() :
+	 m_w(0),
+	 m_h(0),
+	 m_x(0),
+	 m_y(0),
+	 m_length(0),
+	 m_fresh(false) {
+      };
+
+      void start(uint8_t w, uint8_t h) {
+	 m_w = w;
+	 m_h = h;
+	 m_x = 0;
+	 m_y = 0;
+	 m_length = 0;
+	 m_fresh = true;
+	 started();
+      };
+
+      boolean put(const uint8_t *data, uint8_t length) {
+	 if (m_length || !m_w || length > CHUNK) {
+	    m_length = 0;
+	    lost();
+	    return false;
+	 }
+	 memcpy(m_chunk, data, length);
+	 m_length = length;
+	 return true;
+      };
+
+      boolean dirty() {
+	 return m_fresh || m_length;
+      };
+
+      void redraw(UI &ui, Canvas &canvas, const Rect &where) {
+	 if (m_fresh) {
+	    repaint(ui, canvas, where);
+	    m_fresh = false;
+	 }
+
+	 if (m_length) {
+	    Canvas clipped(canvas, where);
+
+	    decode(clipped, where);
+	    ui.damage(clipped.clip());
+	    drawn();
+	 }
+      };
+
+      void draw(Canvas &canvas, const Rect &where) {
+	 if (m_fresh) {
+	    return;
+	 }
+
+	 m_length = 0;
+	 if (m_w) {
+	    m_x = 0;
+	    m_y = 0;
+	    lost();
+	 }
+      };
+
+   protected:
+      // start() has announced a new image.
+      virtual void started() {};
+
+      // The chunk put() last has been drawn.
+      virtual void drawn() {};
+
+      // What has been drawn of the image is gone.
+      virtual void lost() {};
+
+   private:
+      void decode(Canvas &canvas, const Rect &where) {
+	 for (uint8_t i = 0; i < m_length && m_y < m_h; i++) {
+	    boolean black = m_chunk[i] & 0x80;
+	    uint8_t run = (m_chunk[i] & 0x7f) + 1;
+
+	    while (run && m_y < m_h) {
+	       uint8_t span = min(run, m_w - m_x);
+
+	       if (black) {
+		  canvas.drawFastHLine(where.x + m_x, where.y + m_y,
+				       span, BLACK);
+	       }
+	       run -= span;
+	       m_x += span;
+	       if (m_x == m_w) {
+		  m_x = 0;
+		  m_y++;
+	       }
+	    }
+	 }
+	 m_length = 0;
+      };
+
+      uint8_t m_w;
+      uint8_t m_h;
+      uint8_t m_x;
+      uint8_t m_y;
+      uint8_t m_chunk[CHUNK];
+      uint8_t m_length;
+      boolean m_fresh;
+};
+
+
+/*
+ * Where a ListView gets its rows. A source may hold only some of
+ * them, fetching others on demand: row() returns 0 for a row it
+ * doesn't have yet, and the ListView says which rows it is about to
+ * need through want(). The source should touch() itself when rows
+ * arrive, so the list is redrawn.
+ */
+class ListSource : public DirtyFlag {
+   public:
+      static const uint16_t UNKNOWN = 0xffff;
+
+      // The number of rows, or UNKNOWN until the source finds out.
+      virtual uint16_t count() {
+	 return 0;
+      };
+
+      virtual const char *row(uint16_t index) {
+	 return 0;
+      };
+
+      // Rows first to first + n - 1 will be shown soon.
+      virtual void want(uint16_t first, uint8_t n) {};
+
+      virtual void select(uint16_t index) {};
+};
+
+
+/*
+ * A scrolling list, for choosing one of more items than fit in RAM.
+ *
+ * The wheel moves the selection, and the list scrolls to keep it in
+ * view. A CLICK of the select button passes the selection to the
+ * source and closes the list; a CLICK of the back button just closes
+ * it. The list is pushed onto the UI like a screen.
+ *
+ * Rows come from a ListSource, which is told about the rows on
+ * screen, and WINDOW rows either side, so it can fetch them before
+ * the wheel reaches them. Rows which haven't arrived are drawn as
+ * "...", and filled in when they do, so nothing waits on the source.
+ *
+ * Open the list with open(), rather than pushing it. The source is
+ * told what is wanted when the list opens and when the wheel moves,
+ * never while drawing. Call refresh() when the number of rows
+ * changes: it keeps the selection within them, and asks for the rows
+ * now in view.
+ */
+class ListView : public Screen {
+   public:
+      ListView(ListSource &source, uint8_t select_id, uint8_t back_id) :
+	 m_source(source),
+	 m_select_id(select_id),
+	 m_back_id(back_id),
+	 m_selected(0),
+	 m_top(0),
+	 m_rows(1),
+	 m_open(false) {
+      };
+
+      void open(UI &ui) {
+	 ui.push(*this);
+	 m_open = true;
+	 refresh();
+      };
+
+      void refresh() {
+	 uint16_t count = m_source.count();
+
+	 if (count != ListSource::UNKNOWN && m_selected >= count) {
+	    m_selected = count ? count - 1 : 0;
+	 }
+	 follow();
+	 if (m_open) {
+	    uint16_t first = m_top > WINDOW ? m_top - WINDOW : 0;
+	    m_source.want(first, m_top - first + m_rows + WINDOW);
+	 }
+	 m_changed.touch();
+      };
+
+      void draw(Canvas &canvas, const Rect &where) {
+	 uint16_t count = m_source.count();
+
+	 m_rows = max(where.h / ROW_HEIGHT, 1);
+	 follow();
+
+	 canvas.setTextWrap(false);
+	 for (uint8_t r = 0; r < m_rows; r++) {
+	    uint16_t index = m_top + r;
+	    const char *text = 0;
+
+	    if (count != ListSource::UNKNOWN) {
+	       if (index >= count) {
+		  break;
+	       }
+	       text = m_source.row(index);
+	    }
+
+	    canvas.setCursor(where.x, where.y + r * ROW_HEIGHT);
+	    canvas.print(index == m_selected ? '>' : ' ');
+	    if (text) {
+	       canvas.print(text);
+	    } else {
+	       canvas.print(F("..."));
+	    }
+
+	    if (count == ListSource::UNKNOWN) {
+	       break;
+	    }
+	 }
+      };
+
+      boolean dirty() {
+	 return m_changed.dirty() || m_source.dirty();
+      };
+
+      void handle_event(UI &ui, Event &event) {
+	 uint16_t count = m_source.count();
+	 boolean empty = count == 0 || count == ListSource::UNKNOWN;
+
+	 if (event.source == WHEEL) {
+	    if (!empty) {
+	       int32_t selected = (int32_t) m_selected + (char) event.data;
+	       m_selected = constrain(selected, 0, (int32_t) count - 1);
+	       refresh();
+	    }
+	 } else if (event.source == CLICK && event.data == m_select_id) {
+	    if (!empty && m_selected < count) {
+	       m_source.select(m_selected);
+	       close(ui);
+	    }
+	 } else if (event.source == CLICK && event.data == m_back_id) {
+	    close(ui);
+	 }
+      };
+
+      uint16_t selected() {
+	 return m_selected;
+      };
+
+   private:
+      static const uint8_t ROW_HEIGHT = 8;
+      static const uint8_t WINDOW = 2;
+
+      void close(UI &ui) {
+	 m_open = false;
+	 ui.pop();
+      };
+
+      // Keeps the selection in view.
+      void follow() {
+	 if (m_selected < m_top) {
+	    m_top = m_selected;
+	 } else if (m_selected >= m_top + m_rows) {
+	    m_top = m_selected - m_rows + 1;
+	 }
+      };
+
+      ListSource &m_source;
+      const uint8_t m_select_id;
+      const uint8_t m_back_id;
+      DirtyFlag m_changed;
+      uint16_t m_selected;
+      uint16_t m_top;
+      uint8_t m_rows;
+      boolean m_open;
+};
+
+
 /*
  * Controller which uses a button to toggle a boolean value.
  */
@@ -368,23 +997,16 @@ class Toggle : public Controller {
       Toggle(Model<boolean> &model,
 	     uint8_t button_id,
 	     EventType type = CLICK) : 
-	 m_model(model),
-	 m_id(button_id),
-	 m_type(type) {
+	 Controller(type, button_id),
+	 m_model(model) {
       };
 
       void handle_event(UI &ui, Event &event) {
-	 if (event.source == m_type) {
-	    if (event.data == m_id) {
-	       m_model.update(!m_model.value());
-	    };
-	 }
+	 m_model.update(!m_model.value());
       };
 
    private:
       Model<boolean> &m_model;
-      const uint8_t m_id;
-      const EventType m_type;
 };
 
 
@@ -395,6 +1017,7 @@ template <typename T>
 class Knob : public Controller {
    public:
       Knob(Model<T> &model, T coefficient, T min, T max) :
+	 Controller(WHEEL),
 	 m_model(model),
 	 m_coefficient(coefficient),
 	 m_min(min),
@@ -403,13 +1026,11 @@ class Knob : public Controller {
       };
 
       void handle_event(UI &ui, Event &event) {
-	 if (event.source == WHEEL) {
-	    m_model.update(
-	       constrain(
-		  m_model.value() + m_coefficient * char(event.data),
-		  m_min,
-		  m_max));
-	 };
+	 m_model.update(
+	    constrain(
+	       m_model.value() + m_coefficient * char(event.data),
+	       m_min,
+	       m_max));
       };
 
    private:
@@ -428,23 +1049,14 @@ class Command : public Controller {
     Command(
       EventType push_source,
       uint8_t push_id) :
-      m_push_source(push_source),
-      m_push_id(push_id) {
+      Controller(push_source, push_id) {
     };
 
     virtual void action(UI &ui) {};
 
     void handle_event(UI &ui, Event &event) {
-      if (event.source == m_push_source) {
-	if (event.data == m_push_id) {
-	  action(ui);
-	}
-      }
+      action(ui);
     };
-
-  private:
-    EventType m_push_source;
-    const uint8_t m_push_id;
 };
 
 class PushController : public Command {
@@ -465,6 +1077,24 @@ class PushController : public Command {
     Screen &m_screen;
 };
 
+/*
+ * Opens a ListView; see ListView::open().
+ */
+class OpenListController : public Command {
+  public:
+    OpenListController(ListView &list, EventType src, uint8_t id) :
+      Command::Command(src, id),
+      m_list(list) {
+    };
+
+    void action(UI &ui) {
+      m_list.open(ui);
+    };
+
+  private:
+    ListView &m_list;
+};
+
 class PopController : public Command {
   public:
     PopController(EventType src, uint8_t id) :
@@ -13,6 +13,21 @@ sketch.
 #define NO_PORTC_PINCHANGES
 #define NO_PORTD_PINCHANGES
 
+/*
+ * Raise to LOG_LEVEL_DEBUG to trace BLE input. See Log.h.
+ */
+#ifndef LOG_LEVEL
+#define LOG_LEVEL LOG_LEVEL_WARN
+#endif
+
+/*
+ * Set to 1 to time each stage of the loop. Sending '?' over BLE or
+ * serial then dumps the timings. See Profile.h.
+ */
+#ifndef PROFILE
+#define PROFILE 0
+#endif
+
 /*
  * This is a hack. Let's see if it works.
  */
@@ -28,12 +43,17 @@ sketch.
 
 #include "WheelUI.h"
 #include "MVC.h"
-#include "Icons.h"
+#include "Fixed.h"
+#include "PCD8544Panel.h"
+#include "Protocol.h"
+#include "icons.h"
 
 /*
- * Define the display, including hardware pin-outs.
+ * Define the display, including hardware pin-outs. The panel tracks
+ * which parts of the framebuffer the UI has repainted, so that only
+ * those are sent over SPI.
  */
-Adafruit_PCD8544 display = Adafruit_PCD8544(
+PCD8544Panel display(
    0, // Serial clock out (SCLK)    
    1, // Serial data out (DIN)
    2, // Data/Command select (D/C)
@@ -51,7 +71,12 @@ typedef enum {
    RIGHT_BTN,
 } ButtonIds;
 
-ButtonSrc< 9, INPUT_PULLUP, ENC_BTN, true> encBtn;
+/*
+ * With port C and D pin changes compiled out (see above), only the
+ * encoder button's pin can raise an interrupt, so the other two
+ * buttons are polled.
+ */
+InterruptButtonSrc<9, INPUT_PULLUP, ENC_BTN, true> encBtn;
 ButtonSrc<12, INPUT_PULLUP, LEFT_BTN, true> leftBtn;
 ButtonSrc<13, INPUT_PULLUP, RIGHT_BTN, true> rightBtn;
 EncoderSrc<'a', 10, 11, WHEEL> encoder;
@@ -59,18 +84,18 @@ EncoderSrc<'a', 10, 11, WHEEL> encoder;
 /*
  * Define a model for the contrast setting on a supported display.
  */
-class ContrastModel : public ProxyModel<double> {
+class ContrastModel : public ProxyModel<Fixed> {
    public:
-      ContrastModel(Adafruit_PCD8544 &display, double value) :
-	 ProxyModel<double>::ProxyModel(value),
+      ContrastModel(Adafruit_PCD8544 &display, Fixed value) :
+	 ProxyModel<Fixed>::ProxyModel(value),
 	 m_display(display)
       {
 	 update(value);
       };
 
-      void update(double value) {
+      void update(Fixed value) {
 	 m_display.setContrast(min_contrast + 
-			       value * double(max_contrast - min_contrast));
+			       value.scale(max_contrast - min_contrast));
 	 proxy_set(value);
       };
 
@@ -83,32 +108,79 @@ class ContrastModel : public ProxyModel<double> {
 };
 
 /*
- * A controller which translates encoder pulses into volume up/down
+ * Commands for the phone are queued here by the controllers below,
+ * and sent once per loop(). Two packets per 20ms is about what the
+ * nRF8001 sustains without backing up.
+ */
+TxQueue<32, 2, 20> g_tx;
+
+/*
+ * A controller which translates encoder pulses into relative volume
  * commands over bluetooth. We don't need to store any actual data.
+ *
+ * Rather than one command per detent, the deltas of all the WHEEL
+ * events seen within WINDOW ms of the first are added up, and sent
+ * as a single MSG_VOLUME_DELTA by flush(), which loop() calls before
+ * draining the TX queue. A fast spin thus becomes one message, and
+ * the phone applies it as one jump.
+ *
+ * Each detent is also applied to the volume model straight away, so
+ * the indicator moves on the next frame rather than after the phone
+ * has echoed the change; see ReconciledModel.
  */
+typedef ReconciledModel<Fixed, 4> VolumeModel;
+
 class VolumeControl : public Controller {
    public:
 
-      VolumeControl() : Controller() {};
+      VolumeControl(VolumeModel &model) :
+	 Controller(WHEEL),
+	 m_model(model),
+	 m_pending(0) {};
 
       void handle_event(UI &ui, Event &event) {
-	 char i;
-	 char d = (char) event.data;
-	 
-	 if (event.source == WHEEL) {
-	    if (d > 0) {
-	       for (i = 0; i < d; i++) {
-		  ble_write('V');
-	       }
-	    } else {
-	       for (i = 0; i > d; i--) {
-		  ble_write('v');
-	       }
-	    }
+	 if (!m_pending) {
+	    m_since = millis();
 	 }
+	 m_pending += (char) event.data;
+	 m_model.adjust(STEP * (char) event.data);
       }
+
+      // True while there are deltas waiting to be sent.
+      boolean pending() {
+	 return m_pending != 0;
+      }
+
+      void flush() {
+	 m_model.expire();
+	 if (!m_pending ||
+	     (unsigned long) (millis() - m_since) < WINDOW ||
+	     !m_model.ready()) {
+	    return;
+	 }
+
+	 int8_t delta = constrain(m_pending, -128, 127);
+	 uint8_t payload[] = {m_model.next_seq(), (uint8_t) delta};
+	 if (g_tx.put_frame(MSG_VOLUME_DELTA, payload, sizeof(payload))) {
+	    m_pending -= delta;
+	    m_since = millis();
+	    m_model.sent(STEP * delta);
+	 }
+      }
+
+   private:
+      static const uint8_t WINDOW = 30;
+
+      // One step of the phone app's volume control, out of 255.
+      static const Fixed STEP;
+
+      VolumeModel &m_model;
+      int16_t m_pending;
+      unsigned long m_since;
 };
 
+const Fixed VolumeControl::STEP = 8.0 / 255;
+
 /*
  * A controller which maps a button event to a bluetooth
  * command.
@@ -118,50 +190,241 @@ class NetworkController : public Controller {
       NetworkController(char code,
 			uint8_t event,
 			uint8_t id) :
-	 m_code(code),
-	 m_event(event),
-	 m_id(id) {
+	 Controller(event, id),
+	 m_code(code) {
       }
 
       void handle_event(UI &ui, Event &event) {
-	 if (event.source == m_event &&
-	     event.data == m_id) {
-	    ble_write(m_code);
-	 }
+	 g_tx.put(m_code);
       }
 
    private:
       char m_code;
-      uint8_t m_event;
-      uint8_t m_id;
 };
 
 
+/*
+ * Text which never changes is kept in flash; see flash().
+ */
+const char s_source[]   PROGMEM = "Spotify(Starred)";
+const char s_artist[]   PROGMEM = "Phill Collins";
+const char s_track[]    PROGMEM = "In the air tonight.";
+const char s_contrast[] PROGMEM = "Contrast:";
+const char s_playlist[] PROGMEM = "Playlist:";
+const char s_unpaired[] PROGMEM = "Disonnected.";
+
 /*
  * Define the data that we want to display and manipulate.
  */
-DirectModel<double>   g_volume(0.5);
+VolumeModel           g_volume(0.5, 0, 1);
 DirectModel<boolean>  g_playing(false);
 DirectModel<boolean>  g_online(false);
 DirectModel<boolean>  g_paired(false);
-DirectStringModel<25> g_source("Spotify(Starred)");
-DirectStringModel<25> g_artist("Phill Collins");
-DirectStringModel<25> g_track("In the air tonight.");
+StagedStringModel<25> g_source(flash(s_source));
+StagedStringModel<25> g_artist(flash(s_artist));
+StagedStringModel<25> g_track(flash(s_track));
 ContrastModel         g_contrast(display, 0.5);
 
+/*
+ * The artist and title of the tracks either side of the current one,
+ * which the phone sends ahead of time. Skipping to one of them shows
+ * it at once, rather than after the phone has answered the skip; the
+ * phone's answer then confirms it, or corrects it. Empty until the
+ * phone has sent them.
+ */
+struct TrackInfo {
+   char artist[25];
+   char track[25];
+
+   boolean known() {
+      return artist[0] || track[0];
+   };
+
+   void set(char *field, const char *value) {
+      strncpy(field, value, 24);
+      field[24] = 0;
+   };
+
+   void store(const char *a, const char *t) {
+      set(artist, a);
+      set(track, t);
+   };
+
+   void forget() {
+      artist[0] = 0;
+      track[0] = 0;
+   };
+};
+
+TrackInfo g_next_up;
+TrackInfo g_prev_up;
+
+/*
+ * A controller which skips tracks: it sends code to the phone, and if
+ * the track being skipped to is known, makes it the current one
+ * straight away. Either way the current track becomes the one behind,
+ * and the one ahead is unknown until the phone sends it.
+ */
+class SkipController : public Controller {
+   public:
+      SkipController(char code,
+		     TrackInfo &ahead,
+		     TrackInfo &behind,
+		     uint8_t event,
+		     uint8_t id) :
+	 Controller(event, id),
+	 m_code(code),
+	 m_ahead(ahead),
+	 m_behind(behind) {
+      }
+
+      void handle_event(UI &ui, Event &event) {
+	 g_tx.put(m_code);
+	 m_behind.store(g_artist.value(), g_track.value());
+
+	 if (m_ahead.known()) {
+	    // Not update(): a title may be arriving from the phone.
+	    g_artist.replace(m_ahead.artist);
+	    g_track.replace(m_ahead.track);
+	    m_ahead.forget();
+	 }
+      }
+
+   private:
+      char m_code;
+      TrackInfo &m_ahead;
+      TrackInfo &m_behind;
+};
+
+/*
+ * The phone's playlists, for the playlist browser.
+ *
+ * There may be hundreds, so only the CACHED most recently shown are
+ * kept. Those the browser wants which aren't are asked for in runs of
+ * up to PAGE, with one request outstanding at a time; a request
+ * which goes unanswered for TIMEOUT ms is given up on. Only rows the
+ * browser wants are fetched, and it never wants more than CACHED, so
+ * fetching never evicts a row which is about to be shown.
+ */
+class PlaylistSource : public ListSource {
+   public:
+      PlaylistSource() {
+	 forget();
+      };
+
+      uint16_t count() {
+	 return m_count;
+      };
+
+      const char *row(uint16_t index) {
+	 return m_cache.get(index);
+      };
+
+      void want(uint16_t first, uint8_t n) {
+	 if (m_pending &&
+	     (unsigned long) (millis() - m_requested) < TIMEOUT) {
+	    return;
+	 }
+	 m_pending = 0;
+
+	 if (m_count == UNKNOWN) {
+	    request(0, PAGE);
+	    return;
+	 }
+
+	 uint16_t end = min((uint32_t) first + n, m_count);
+	 for (uint16_t i = first; i < end; i++) {
+	    if (!m_cache.contains(i)) {
+	       uint8_t run = 1;
+	       while (run < PAGE && i + run < end &&
+		      !m_cache.contains(i + run)) {
+		  run++;
+	       }
+	       request(i, run);
+	       return;
+	    }
+	 }
+      };
+
+      void select(uint16_t index) {
+	 uint8_t payload[] = {
+	    (uint8_t) (index & 0xff), (uint8_t) (index >> 8)
+	 };
+	 g_tx.put_frame(MSG_LIST_SELECT, payload, sizeof(payload));
+      };
+
+      // From MSG_LIST_SIZE.
+      void set_count(uint16_t count) {
+	 m_count = count;
+	 if (!count) {
+	    m_pending = 0;
+	 }
+	 touch();
+      };
+
+      // From MSG_LIST_ENTRY.
+      void put(uint16_t index, const char *name) {
+	 m_cache.put(index, name);
+	 if (m_pending && index == m_last) {
+	    m_pending = 0;
+	 }
+	 touch();
+      };
+
+      // The link dropped, and the playlists may be different when it
+      // comes back.
+      void forget() {
+	 m_count = UNKNOWN;
+	 m_pending = 0;
+	 m_cache.clear();
+      };
+
+   private:
+      static const uint8_t CACHED = 12;
+      static const uint8_t PAGE = 4;
+      static const unsigned int TIMEOUT = 1000;
+
+      void request(uint16_t first, uint8_t n) {
+	 uint8_t payload[] = {
+	    (uint8_t) (first & 0xff), (uint8_t) (first >> 8), n
+	 };
+
+	 if (g_tx.put_frame(MSG_LIST_REQUEST, payload, sizeof(payload))) {
+	    m_pending = n;
+	    m_last = first + n - 1;
+	    m_requested = millis();
+	 }
+      };
+
+      EntryCache<CACHED, 14> m_cache;
+      uint16_t m_count;
+      uint8_t m_pending;
+      uint16_t m_last;
+      unsigned long m_requested;
+};
+
+PlaylistSource g_playlists;
+
 /*
  * Settings Screen.
  */
-Label g_contrast_label("Contrast:");
-Label g_playlist_label("Playlist:");
-RangeView<double> g_contrast_indicator(g_contrast, 0, 1.0);
+Label g_contrast_label(flash(s_contrast));
+Label g_playlist_label(flash(s_playlist));
+RangeView<Fixed> g_contrast_indicator(g_contrast, 0, 1);
 
-Knob<double> g_contrast_controller(g_contrast, 0.05, 0, 1.0);
+Knob<Fixed> g_contrast_controller(g_contrast, 0.05, 0, 1);
 PopController g_back_button(CLICK, ENC_BTN);
 NetworkController g_prev_playlist('p', CLICK, LEFT_BTN);
 NetworkController g_next_playlist('n', CLICK, RIGHT_BTN);
 
-Layout<3, 4> settings_layout = {
+/*
+ * Holding the wheel's button opens the playlist browser, where the
+ * button picks a playlist and the left button goes back.
+ */
+ListView g_playlist_browser(g_playlists, ENC_BTN, LEFT_BTN);
+OpenListController g_browse_playlists(g_playlist_browser, HOLD, ENC_BTN);
+
+Layout<3, 5> settings_layout = {
    {
       {{ 0,  0, LCDWIDTH - 1, 10}, g_contrast_label},
       {{ 0,  8, LCDWIDTH - 1,  6}, g_contrast_indicator},
@@ -171,19 +434,71 @@ Layout<3, 4> settings_layout = {
       {g_contrast_controller},
       {g_back_button},
       {g_prev_playlist},
-      {g_next_playlist}
+      {g_next_playlist},
+      {g_browse_playlists}
    }
 };
 
-CompositeScreen<3, 4> g_settings(settings_layout);
+CompositeScreen<3, 5> g_settings(settings_layout);
+
+/*
+ * Album art for the current track, which the phone streams in chunks.
+ * Each chunk is acknowledged once it's drawn, which is the phone's
+ * cue to send the next, and if the art is lost it is asked for again.
+ * flush(), called before the TX queue is drained, sends whichever is
+ * owed, so neither is lost if the queue is full.
+ */
+class AlbumArt : public StreamedImage<22> {
+   public:
+      AlbumArt() :
+	 m_ack(false),
+	 m_request(false) {
+      };
+
+      boolean pending() {
+	 return m_ack || m_request;
+      };
+
+      void flush() {
+	 if (m_request) {
+	    m_request = !g_tx.put_frame(MSG_ART_REQUEST, 0, 0);
+	 } else if (m_ack) {
+	    m_ack = !g_tx.put_frame(MSG_ART_ACK, 0, 0);
+	 }
+      };
+
+   protected:
+      // An ack still waiting from the last image would have the
+      // phone send this one's second chunk before its first is
+      // drawn.
+      void started() {
+	 m_ack = false;
+	 m_request = false;
+      };
+
+      void drawn() {
+	 m_ack = true;
+      };
+
+      void lost() {
+	 m_ack = false;
+	 m_request = true;
+      };
+
+   private:
+      boolean m_ack;
+      boolean m_request;
+};
+
+AlbumArt g_album_art;
 
 /*
  * Views for the main screen.
  */
-ScrolledText g_artist_scroll(g_artist.value());
-ScrolledText g_track_scroll(g_track.value());
-ScrolledText g_source_scroll(g_source.value());
-RangeView<double> g_volume_indicator(g_volume, 0, 1.0);
+ScrolledText g_artist_scroll(g_artist);
+ScrolledText g_track_scroll(g_track);
+ScrolledText g_source_scroll(g_source);
+RangeView<Fixed> g_volume_indicator(g_volume, 0, 1);
 ToggleView g_play_indicator(g_playing, g_play_icon, g_pause_icon);
 ToggleView g_network_indicator(g_online, g_online_icon, g_offline_icon);
 
@@ -191,27 +506,28 @@ ToggleView g_network_indicator(g_online, g_online_icon, g_offline_icon);
 /*
  * Controllers for the main screen.
  */
-VolumeControl  g_volume_controller;
+VolumeControl  g_volume_controller(g_volume);
 PushController g_show_settings(g_settings, HOLD, ENC_BTN);
 
 NetworkController g_play_controller  ('x', CLICK, ENC_BTN);
-NetworkController g_prev_controller  ('P', CLICK, LEFT_BTN);
-NetworkController g_next_controller  ('N', CLICK, RIGHT_BTN);
+SkipController    g_prev_controller  ('P', g_prev_up, g_next_up, CLICK, LEFT_BTN);
+SkipController    g_next_controller  ('N', g_next_up, g_prev_up, CLICK, RIGHT_BTN);
 NetworkController g_online_controller('o', HOLD,  RIGHT_BTN);
 NetworkController g_like_controller  ('L', HOLD,  LEFT_BTN);
 
 /*
  * Define the main screen
  */
-const Layout<7, 7> main_layout = {
+const Layout<8, 7> main_layout = {
    {
-      {{0, 0, LCDWIDTH, 10}, g_source_scroll},
-      {{0, 10, LCDWIDTH, 10}, g_artist_scroll}, 
-      {{0, 20, LCDWIDTH, 10}, g_track_scroll},
-      {{LCDWIDTH - 11, LCDHEIGHT - 9, 0, 0}, g_speaker_icon},
+      {{0, 0, LCDWIDTH - 26, 10}, g_source_scroll},
+      {{0, 10, LCDWIDTH - 26, 10}, g_artist_scroll}, 
+      {{0, 20, LCDWIDTH - 26, 10}, g_track_scroll},
+      {{LCDWIDTH - 24, 0, 24, 24}, g_album_art},
+      {{LCDWIDTH - 11, LCDHEIGHT - 9, 11, 8}, g_speaker_icon},
       {{30, LCDHEIGHT - 9, 40, 8}, g_volume_indicator},
-      {{0, LCDHEIGHT - 9, 0, 0}, g_play_indicator},
-      {{10, LCDHEIGHT - 9, 0, 0}, g_network_indicator},
+      {{0, LCDHEIGHT - 9, 8, 9}, g_play_indicator},
+      {{12, LCDHEIGHT - 9, 12, 8}, g_network_indicator},
    },
    {
       {g_play_controller},
@@ -224,19 +540,102 @@ const Layout<7, 7> main_layout = {
    }
 };
 
-CompositeScreen<7, 7> home(main_layout);
+CompositeScreen<8, 7> home(main_layout, PROFILE_HOME_VIEWS);
 
 /*
  * This screen shows if we are not paired to a phone.
  */
-Label g_unpaired_screen("Disonnected.");
+Label g_unpaired_screen(flash(s_unpaired));
 ToggleView root(g_paired, home, g_unpaired_screen);
 
 /*
  * Initialize the UI with our root screen.
  */
 
-UI ui(display, root);
+UI ui(display, root, display, &display);
+
+/*
+ * Applies a validated binary frame (see Protocol.h) to the models.
+ */
+void handle_frame(uint8_t type, const uint8_t *payload, uint8_t length) {
+   switch (type) {
+      case MSG_PLAYING:
+	 if (length == 1) {
+	    g_playing.update(payload[0]);
+	 }
+	 break;
+      case MSG_ONLINE:
+	 if (length == 1) {
+	    g_online.update(payload[0]);
+	 }
+	 break;
+      case MSG_VOLUME:
+	 if (length == 1) {
+	    g_volume.update(Fixed::ratio(payload[0], 255));
+	 }
+	 break;
+      case MSG_VOLUME_ACK:
+	 if (length == 2) {
+	    g_volume.ack(payload[0], Fixed::ratio(payload[1], 255));
+	 }
+	 break;
+      case MSG_SOURCE:
+	 g_source.update((const char *) payload);
+	 break;
+      case MSG_ARTIST:
+	 g_artist.update((const char *) payload);
+	 break;
+      case MSG_TRACK:
+	 g_track.update((const char *) payload);
+	 break;
+      case MSG_NEXT_ARTIST:
+	 g_next_up.set(g_next_up.artist, (const char *) payload);
+	 break;
+      case MSG_NEXT_TRACK:
+	 g_next_up.set(g_next_up.track, (const char *) payload);
+	 break;
+      case MSG_PREV_ARTIST:
+	 g_prev_up.set(g_prev_up.artist, (const char *) payload);
+	 break;
+      case MSG_PREV_TRACK:
+	 g_prev_up.set(g_prev_up.track, (const char *) payload);
+	 break;
+      case MSG_ART_START:
+	 if (length == 2) {
+	    g_album_art.start(payload[0], payload[1]);
+	 }
+	 break;
+      case MSG_ART_DATA:
+	 if (!g_album_art.put(payload, length)) {
+	    log_warn(F("art chunk refused, requesting again"));
+	 }
+	 break;
+      case MSG_LIST_SIZE:
+	 if (length == 2) {
+	    g_playlists.set_count(payload[0] | payload[1] << 8);
+	    g_playlist_browser.refresh();
+	 }
+	 break;
+      case MSG_LIST_ENTRY:
+	 if (length >= 2) {
+	    g_playlists.put(payload[0] | payload[1] << 8,
+			    (const char *) payload + 2);
+	    // Once a request is answered, ask for any rows still missing.
+	    g_playlist_browser.refresh();
+	 }
+	 break;
+   };
+}
+
+#if PROFILE
+/*
+ * The next row of the profile to send over BLE and serial, or 0xff
+ * when not dumping. A row for each stage is followed by one for each
+ * task, with its overruns and longest run.
+ */
+uint8_t g_ble_dump = 0xff;
+uint8_t g_serial_dump = 0xff;
+#endif
 
 /*
  * I hate to write code like this, but while
@@ -244,122 +643,347 @@ UI ui(display, root);
  * it's the best available approach. It's fast, and roughly
  * constant space. And it avoids including extra
  * string methods in the binary.
+ *
+ * Binary frames are accepted wherever a text command could begin.
+ * After a corrupt frame, everything up to the next FRAME_START is
+ * ignored, so that stray payload bytes aren't taken for commands.
+ * A newline, which ends every text command, also ends the wait, and
+ * so does a pause of TIMEOUT ms, which likewise ends a frame cut
+ * short. reset() starts afresh, for when the link comes or goes.
  */
-void handle_bt_char(char c) {
-   static enum {
+struct BtInput {
+   enum {
       NORMAL = 0,
       STRING,
       VOLUME_LOW,
-      VOLUME_HIGH
+      VOLUME_HIGH,
+      FRAME,
+      RESYNC
    } mode;
 
-   static char *buffer = 0;
-   static uint8_t i = 0;
-   static int volume = 0;
+   FrameDecoder<24> frames;
+   StagedStringModel<25> *target;
+   int volume;
+   uint16_t at;   // when the last byte arrived
 
-   Serial.print('<');
-   Serial.println(c);
+   static const uint16_t TIMEOUT = 250;
 
-   if (mode == STRING) {
-      if (c == '\n') {
-	 mode = NORMAL;
-	 return;
+   void reset() {
+      mode = NORMAL;
+      frames.abandon();
+      if (target) {
+	 target->begin();
+	 target = 0;
+      }
+   };
+
+   void put(char c) {
+      uint16_t now = millis();
+
+      if ((mode == FRAME || mode == RESYNC) &&
+	  (uint16_t) (now - at) > TIMEOUT) {
+	 log_warn(F("BLE frame timed out"));
+	 reset();
       }
+      at = now;
+
+      log_debug('<', (char) c);
 
-      if (i < 24) {
-	 buffer[i] = c;
-	 buffer[i + 1] = 0;
-	 i += 1;
+      if (mode == FRAME) {
+	 if (frames.put(c)) {
+	    handle_frame(frames.type(), frames.payload(), frames.length());
+	    mode = NORMAL;
+	 } else if (!frames.active()) {
+	    mode = RESYNC;
+	 }
 	 return;
-      } else {
-	 Serial.print('!');
+
+      } else if (mode == RESYNC) {
+	 if (c == FRAME_START) {
+	    frames.start();
+	    mode = FRAME;
+	 } else if (c == '\n') {
+	    mode = NORMAL;
+	 }
 	 return;
-      }
 
-   } else if (mode == VOLUME_LOW) {
-      if ((c >= '0') && (c <= '9')) {
-	 volume |= (c - '0');
-      } else if (('a' <= c) && (c <= 'f')) {
-	 volume |= 10 + (c - 'a');
-      }
-      mode = NORMAL;
-      g_volume.update(double(volume) / 255);
-      return;
-
-   } else if (mode == VOLUME_HIGH) {
-      if ((c >= '0') && (c <= '9')) {
-	 volume |= (c - '0');
-      } else if (('a' <= c) && (c <= 'f')) {
-	 volume |= 10 + (c - 'a');
+      } else if (mode == STRING) {
+	 // The string is staged, and only shown once complete.
+	 if (c == '\n') {
+	    target->commit();
+	    mode = NORMAL;
+	 } else if (!target->append(c)) {
+	    log_warn(F("BLE string too long"));
+	 }
+	 return;
+
+      } else if (mode == VOLUME_LOW) {
+	 if ((c >= '0') && (c <= '9')) {
+	    volume |= (c - '0');
+	 } else if (('a' <= c) && (c <= 'f')) {
+	    volume |= 10 + (c - 'a');
+	 }
+	 mode = NORMAL;
+	 g_volume.update(Fixed::ratio(volume, 255));
+	 return;
+
+      } else if (mode == VOLUME_HIGH) {
+	 if ((c >= '0') && (c <= '9')) {
+	    volume |= (c - '0');
+	 } else if (('a' <= c) && (c <= 'f')) {
+	    volume |= 10 + (c - 'a');
+	 }
+	 volume = volume << 4;
+	 mode = VOLUME_LOW;
+	 return;
       }
-      volume = volume << 4;
-      mode = VOLUME_LOW;
-      return;
-   }
 
-   switch (c) {
-      case 'x':
-	 g_playing.update(false);
-	 break;
-      case 'X':
-	 g_playing.update(true);
-	 break;
-      case 'o':
-	 g_online.update(false);
-	 break;
-      case 'O':
-	 g_online.update(true);
-	 break;
-      case 's':
-	 buffer = (char *) g_source.value();
-	 mode = STRING;
-	 i = 0;
-	 break;
-      case 'a':
-	 buffer = (char *) g_artist.value();
-	 mode = STRING;
-	 i = 0;
-	 break;
-      case 't':
-	 buffer = (char *) g_track.value();
-	 mode = STRING;
-	 i = 0;
-	 break;
-      case 'v':
-	 volume = 0;
-	 mode = VOLUME_HIGH;
-	 break;
+      switch (c) {
+	 case FRAME_START:
+	    frames.start();
+	    mode = FRAME;
+	    break;
+	 case 'x':
+	    g_playing.update(false);
+	    break;
+	 case 'X':
+	    g_playing.update(true);
+	    break;
+	 case 'o':
+	    g_online.update(false);
+	    break;
+	 case 'O':
+	    g_online.update(true);
+	    break;
+	 case 's':
+	    target = &g_source;
+	    target->begin();
+	    mode = STRING;
+	    break;
+	 case 'a':
+	    target = &g_artist;
+	    target->begin();
+	    mode = STRING;
+	    break;
+	 case 't':
+	    target = &g_track;
+	    target->begin();
+	    mode = STRING;
+	    break;
+	 case 'v':
+	    volume = 0;
+	    mode = VOLUME_HIGH;
+	    break;
+   #if PROFILE
+	 case '?':
+	    g_ble_dump = 0;
+	    break;
+   #endif
+      };
    };
-}
+};
 
-void loop() {
-   static unsigned long next = 0;
-   uint8_t paired;
+BtInput g_bt_input;
+
+/*
+ * The main loop, as tasks. See Scheduler.
+ *
+ * Once nothing has happened for IDLE_AFTER ms -- no input, no model
+ * changed, no BLE traffic -- the tasks drop to their idle periods, and
+ * the CPU spends most of its time asleep. Anything happening calls
+ * active(), which brings them straight back to full speed. Input is
+ * still polled every few ms while idle, and everything runs as soon
+ * as it is noticed, so the first frame after waking is drawn well
+ * within a frame period. A scrolling title is not activity: while
+ * one is shown, only rendering and flushing keep their full rate.
+ */
+const uint16_t IDLE_AFTER = 2000;
+uint16_t g_active_at;
 
-   // Poll input sources for events
+void active();
+void quiet();
+
+// Poll input sources for events.
+void poll_inputs(Task &task) {
+   PROFILE_SCOPE(PROFILE_POLL);
    encoder.poll(ui);
    encBtn.poll(ui);
    leftBtn.poll(ui);
    rightBtn.poll(ui);
 
-   // Poll for bluetooth connectivity and data.
+   if (ui.pending()) {
+      active();
+   }
+}
+
+// Poll for bluetooth connectivity and data. A long burst of input is
+// handled over several runs.
+void receive(Task &task) {
+   PROFILE_SCOPE(PROFILE_RECEIVE);
+   uint8_t paired;
+
    if ((paired = ble_connected()) != g_paired.value()) {
       g_paired.update(paired);
+      g_tx.clear();
+      g_bt_input.reset();
+      g_volume.forget();
+      g_next_up.forget();
+      g_prev_up.forget();
+      g_playlists.forget();
+      if (paired) {
+	 g_playlist_browser.refresh();
+      }
+      active();
    }
 
-   while (ble_available()) {
-      handle_bt_char(ble_read());
+   if (ble_available()) {
+      active();
    }
+
+   while (ble_available() && !task.over_budget()) {
+      g_bt_input.put(ble_read());
+   }
+}
+
+// Send whatever the controllers queued, in as few packets as
+// possible, and let the BLE library process its events.
+void transmit(Task &task) {
+   if (g_tx.count() || g_volume_controller.pending() ||
+       g_album_art.pending()) {
+      active();
+   }
+
+   g_volume_controller.flush();
+   g_album_art.flush();
+   g_tx.drain();
+
+   PROFILE_SCOPE(PROFILE_BLE_EVENTS);
    ble_do_events();
+}
 
-   // update screen every 25ms
-   // TODO: dirty detection
-   if (millis() > next) {
-      display.clearDisplay();
-      ui.loop();
-      next = millis() + 25;
+// Only views whose models changed since the last update are actually
+// redrawn.
+void render(Task &task) {
+   if (ui.loop()) {
+      active();
+   } else {
+      quiet();
    }
-   display.display();
+   if (ui.animated()) {
+      task.keep_pace();
+   }
+}
+
+// Send whatever was repainted to the panel. This does nothing if the
+// last tick didn't change anything.
+void flush(Task &task) {
+   PROFILE_SCOPE(PROFILE_FLUSH);
+   display.flush();
+   if (ui.animated()) {
+      task.keep_pace();
+   }
+}
+
+void drain_log(Task &task) {
+   log_drain();
+}
+
+#if PROFILE
+void report_profile(Task &task);
+#endif
+
+//                   name  function     period(ms) budget(us) idle(ms)
+Task g_input_task   ('i',  poll_inputs,  1,          500,      8);
+Task g_receive_task ('r',  receive,      2,         2000,     20);
+Task g_transmit_task('t',  transmit,     2,         2000,     20);
+Task g_render_task  ('d',  render,      25,        10000,    200);
+Task g_flush_task   ('f',  flush,        5,         8000,     50);
+Task g_log_task     ('l',  drain_log,   20,          500,    200);
+#if PROFILE
+Task g_profile_task ('p',  report_profile, 20,       500,    200);
+#endif
+
+// In order of priority.
+Task *const g_tasks[] = {
+   &g_input_task,
+   &g_receive_task,
+   &g_transmit_task,
+   &g_render_task,
+   &g_flush_task,
+   &g_log_task,
+#if PROFILE
+   &g_profile_task,
+#endif
+};
+
+const uint8_t TASKS = sizeof(g_tasks) / sizeof(g_tasks[0]);
+
+Scheduler<TASKS> g_scheduler(g_tasks);
+
+#if PROFILE
+const uint8_t PROFILE_ROWS = PROFILE_STAGES + TASKS;
+
+// Send a row of the profile wherever one was asked for, if it fits
+// without blocking: text over serial, a MSG_PROFILE or
+// MSG_TASK_PROFILE frame over BLE.
+void report_profile(Task &task) {
+   if (Serial.read() == '?') {
+      g_serial_dump = 0;
+   }
+
+   if (g_serial_dump < PROFILE_ROWS &&
+       Serial.availableForWrite() >= PROFILE_LINE_SIZE) {
+      if (g_serial_dump < PROFILE_STAGES) {
+	 g_profiler.print_row(Serial, g_serial_dump);
+      } else {
+	 Task &t = *g_tasks[g_serial_dump - PROFILE_STAGES];
+
+	 Serial.print(t.name());
+	 Serial.print(' ');
+	 Serial.print(t.overruns());
+	 Serial.print(' ');
+	 Serial.println(t.worst());
+      }
+      g_serial_dump++;
+   }
+
+   if (g_ble_dump < PROFILE_ROWS &&
+       g_tx.space() >= PROFILE_ROW_SIZE + 4) {
+      if (g_ble_dump < PROFILE_STAGES) {
+	 uint8_t row[PROFILE_ROW_SIZE];
+
+	 g_profiler.pack_row(row, g_ble_dump);
+	 g_tx.put_frame(MSG_PROFILE, row, sizeof(row));
+      } else {
+	 Task &t = *g_tasks[g_ble_dump - PROFILE_STAGES];
+	 uint8_t row[] = {
+	    (uint8_t) t.name(),
+	    (uint8_t) (t.overruns() & 0xff), (uint8_t) (t.overruns() >> 8),
+	    (uint8_t) (t.worst() & 0xff), (uint8_t) (t.worst() >> 8),
+	 };
+
+	 g_tx.put_frame(MSG_TASK_PROFILE, row, sizeof(row));
+      }
+      g_ble_dump++;
+   }
+}
+#endif
+
+// Something happened: back to full speed.
+void active() {
+   g_active_at = millis();
+   g_scheduler.idle(false);
+}
+
+// Nothing did: slow down if that has been so for long enough.
+void quiet() {
+   if ((uint16_t) ((uint16_t) millis() - g_active_at) >= IDLE_AFTER) {
+      g_scheduler.idle(true);
+   }
+}
+
+void loop() {
+   g_scheduler.run();
 }
 
 void setup() {
@@ -368,7 +992,7 @@ void setup() {
    ble_begin();
 
    encoder.init();
-   encBtn.init();
+   encBtn.init(ui);
    leftBtn.init();
    rightBtn.init();
   
@@ -3,71 +3,83 @@
 
 #include "WheelUI.h"
 
+/*
+ * Icons, column by column, in the layout described at IconView. Each
+ * is drawn in the comment above it.
+ */
+
+//      #  #
+//     ##   #
+//    ### #  #
+// ######  # #
+// ######  # #
+//    ### #  #
+//     ##   #
+//      #  #
 static const uint8_t PROGMEM SPEAKER_DATA[] = {
-   B00000100, B10000000,
-   B00001100, B01000000,
-   B00011101, B00100000,
-   B11111100, B10100000,
-   B11111100, B10100000,
-   B00011101, B00100000,
-   B00001100, B01000000,
-   B00000100, B10000000,
+   0x18, 0x18, 0x18, 0x3c, 0x7e, 0xff, 0x00, 0x24, 0x99, 0x42, 0x3c,
 };
 
-IconView g_speaker_icon(16, 8, SPEAKER_DATA);
+IconView g_speaker_icon(11, 8, SPEAKER_DATA);
 
-static const unsigned char PROGMEM PLAY_DATA[] = {
-   B00100000,
-   B00110000,
-   B00111000,
-   B00111100,
-   B00111110,
-   B00111100,
-   B00111000,
-   B00110000,
-   B00100000,
+//   #
+//   ##
+//   ###
+//   ####
+//   #####
+//   ####
+//   ###
+//   ##
+//   #
+static const uint8_t PROGMEM PLAY_DATA[] = {
+   0x00, 0x00, 0xff, 0xfe, 0x7c, 0x38, 0x10,
+   0x00, 0x00, 0x01, 0x00, 0x00, 0x00, 0x00,
 };
 
-IconView g_play_icon(8, 9, PLAY_DATA);
+IconView g_play_icon(7, 9, PLAY_DATA);
 
-static const unsigned char PROGMEM PAUSE_DATA[] = {
-   B11100111,
-   B11100111,
-   B11100111,
-   B11100111,
-   B11100111,
-   B11100111,
-   B11100111,
-   B11100111,
-   B11100111,
+// ###  ###
+// ###  ###
+// ###  ###
+// ###  ###
+// ###  ###
+// ###  ###
+// ###  ###
+// ###  ###
+// ###  ###
+static const uint8_t PROGMEM PAUSE_DATA[] = {
+   0xff, 0xff, 0xff, 0x00, 0x00, 0xff, 0xff, 0xff,
+   0x01, 0x01, 0x01, 0x00, 0x00, 0x01, 0x01, 0x01,
 };
 
 IconView g_pause_icon(8, 9, PAUSE_DATA);
 
-static const unsigned char PROGMEM OFFLINE_DATA[] = {
-   B00000011, B11000000, 
-   B00011100, B00111000, 
-   B00100000, B00000100, 
-   B00010000, B00001000, 
-   B00001000, B00010000, 
-   B00000100, B00100000, 
-   B00000010, B01000000, 
-   B00000001, B10000000, 
-};	      
-	      
-IconView g_offline_icon(16, 8, OFFLINE_DATA);
-	      
-static const  unsigned char PROGMEM ONLINE_DATA[] = {
-   B00000011, B11000000, 
-   B00011100, B00111000, 
-   B00100000, B00000100, 
-   B00000011, B11000000, 
-   B00001100, B00110000, 
-   B00000000, B00000000, 
-   B00000001, B10000000, 
-   B00000001, B10000000, 
+//     ####
+//  ###    ###
+// #          #
+//  #        #
+//   #      #
+//    #    #
+//     #  #
+//      ##
+static const uint8_t PROGMEM OFFLINE_DATA[] = {
+   0x04, 0x0a, 0x12, 0x22, 0x41, 0x81, 0x81, 0x41, 0x22, 0x12, 0x0a, 0x04,
+};
+
+IconView g_offline_icon(12, 8, OFFLINE_DATA);
+
+//     ####
+//  ###    ###
+// #          #
+//     ####
+//   ##    ##
+//
+//      ##
+//      ##
+static const uint8_t PROGMEM ONLINE_DATA[] = {
+   0x04, 0x02, 0x12, 0x12, 0x09, 0xc9, 0xc9, 0x09, 0x12, 0x12, 0x02, 0x04,
 };
 
-IconView g_online_icon(16, 8, ONLINE_DATA);
+IconView g_online_icon(12, 8, ONLINE_DATA);
 
 #endif
@@ -0,0 +1,380 @@
+/* bench.cpp
+ *
+ * Render-path benchmark for the sketch, built against the host stubs.
+ *
+ * Each scenario puts the UI into one of its screens, runs loop() on
+ * the virtual clock, and reports what the firmware asked of the
+ * display: drawing primitives by kind, pixels written into the
+ * framebuffer and bytes flushed to the panel. Figures are given for
+ * the first frame after entering the screen, and averaged per frame
+ * (one 25 ms redraw period) over the steady state which follows.
+ *
+ * Run with -d to also print what the panel shows at the end of each
+ * scenario.
+ */
+
+#include <stdio.h>
+
+#include "Arduino.h"
+#include "../btremote.ino"
+#include "sim.h"
+#include "phone.h"
+
+// Virtual time taken by one pass of loop().
+static const unsigned long PASS_US = 1000;
+static const unsigned long FRAME_MS = 25;
+static const unsigned long STEADY_MS = 4000;
+
+typedef void (*Action)();
+typedef void (*Script)(unsigned long ms);
+
+struct Scenario {
+   const char *name;
+   Action enter;
+   Script during;  // called before every pass of loop(), may be 0
+};
+
+static Phone phone;
+
+static void unpaired() {
+   sim::ble_connect(false);
+}
+
+static void paired() {
+   sim::ble_connect(true);
+}
+
+static void settings() {
+   sim::ble_connect(true);
+   ui.push(g_settings);
+}
+
+static void leave_settings() {
+   ui.pop();
+}
+
+static void playlists() {
+   sim::ble_connect(true);
+   ui.push(g_settings);
+   g_playlist_browser.open(ui);
+   active();  // as the button press which opens it would
+}
+
+static const char *const tracks[] = {
+   "aGenesis\ntInvisible Touch\nv80\n",
+   "aPeter Gabriel\ntSledgehammer\nv90\n",
+};
+
+static void track_change(unsigned long ms) {
+   static uint8_t n = 0;
+
+   if (ms % 1000) {
+      return;
+   }
+
+   sim::ble_feed(tracks[n++ % 2]);
+}
+
+// The same, but arriving a byte per ms, as over a slow link. Titles
+// should still change in one step, never showing half-received.
+static void trickled_track_change(unsigned long ms) {
+   static uint8_t n = 0;
+   static const char *next = 0;
+
+   if (ms % 1000 == 0) {
+      next = tracks[n++ % 2];
+   }
+   if (next && *next) {
+      sim::ble_feed((const uint8_t *) next++, 1);
+   }
+}
+
+// Sends a binary frame, as described in Protocol.h.
+static void feed_frame(uint8_t type, const uint8_t *payload, uint8_t length) {
+   uint8_t header[] = {FRAME_START, type, length};
+   uint8_t crc = crc8(crc8(0, type), length);
+
+   for (uint8_t i = 0; i < length; i++) {
+      crc = crc8(crc, payload[i]);
+   }
+
+   sim::ble_feed(header, sizeof(header));
+   sim::ble_feed(payload, length);
+   sim::ble_feed(&crc, 1);
+}
+
+static void feed_frame(uint8_t type, const char *str) {
+   feed_frame(type, (const uint8_t *) str, strlen(str));
+}
+
+static void feed_frame(uint8_t type, uint8_t value) {
+   feed_frame(type, &value, 1);
+}
+
+static void framed_track_change(unsigned long ms) {
+   static uint8_t n = 0;
+
+   if (ms % 1000) {
+      return;
+   }
+
+   if (n++ % 2) {
+      feed_frame(MSG_ARTIST, "Genesis");
+      feed_frame(MSG_TRACK, "Invisible Touch");
+      feed_frame(MSG_VOLUME, 0x80);
+   } else {
+      feed_frame(MSG_ARTIST, "Peter Gabriel");
+      feed_frame(MSG_TRACK, "Sledgehammer");
+      feed_frame(MSG_VOLUME, 0x90);
+   }
+}
+
+// Spins the wheel by 20 clicks over 100ms, once a second.
+static void wheel_spin(unsigned long ms) {
+   if (ms % 1000 < 100 && ms % 5 == 0) {
+      sim::turn(1);
+   }
+}
+
+// Clicks the encoder button once a second, with contact bounce on
+// both edges.
+static void bouncy_click(unsigned long ms) {
+   static const int8_t levels[] = {LOW, HIGH, LOW, HIGH, LOW};
+
+   switch (ms % 1000) {
+      case 0: case 1: case 2: case 3: case 4:
+	 sim::set_pin(9, levels[ms % 1000]);
+	 break;
+      case 80: case 82:
+	 sim::set_pin(9, HIGH);
+	 break;
+      case 81:
+	 sim::set_pin(9, LOW);
+	 break;
+   }
+}
+
+// Holds the left button for 1.5s every 2s. HOLD should reach the
+// phone as a 'L' while the button is still down.
+static unsigned long s_liked;
+
+static void long_press(unsigned long ms) {
+   switch (ms % 2000) {
+      case 0:
+	 sim::set_pin(12, LOW);
+	 break;
+      case 1500:
+	 sim::set_pin(12, HIGH);
+	 s_liked = phone.liked;
+	 break;
+   }
+}
+
+// Clicks the right button, skipping to the next track, once a
+// second, and times how long after the click the new title is shown.
+// Until the phone has sent the next track ahead of time, that is as
+// long as the phone takes to answer.
+static unsigned long s_skips;
+static unsigned long s_first_skip_ms;
+static unsigned long s_skip_ms;
+
+static void skip_tracks(unsigned long ms) {
+   static char shown[25];
+   static unsigned long clicked;
+   static boolean waiting = false;
+
+   switch (ms % 1000) {
+      case 0:
+	 sim::set_pin(13, LOW);
+	 break;
+      case 150:
+	 sim::set_pin(13, HIGH);
+	 strcpy(shown, g_track.value());
+	 clicked = ms;
+	 waiting = true;
+	 break;
+   }
+
+   if (waiting && strcmp(shown, g_track.value())) {
+      if (s_skips++) {
+	 s_skip_ms += ms - clicked;
+      } else {
+	 s_first_skip_ms = ms - clicked;
+      }
+      waiting = false;
+   }
+}
+
+// The same, but each skip is acted on while the artist of another
+// track is trickling in, as when the phone reports a change of its
+// own. Once it has arrived, that artist should be shown whole,
+// whatever the skip showed meanwhile.
+static unsigned long s_torn;
+
+static void skip_mid_title(unsigned long ms) {
+   static uint8_t n = 0;
+   static const char *next = 0;
+
+   switch (ms % 1000) {
+      case 0:
+	 sim::set_pin(13, LOW);
+	 break;
+      case 160:
+	 next = tracks[n++ % 2];
+	 break;
+      case 150:
+	 sim::set_pin(13, HIGH);
+	 break;
+      case 250: {
+	 const char *fed = tracks[(n - 1) % 2] + 1;
+
+	 if (strncmp(g_artist.value(), fed, strchr(fed, '\n') - fed)) {
+	    s_torn++;
+	 }
+	 break;
+      }
+   }
+   if (next && *next) {
+      sim::ble_feed((const uint8_t *) next++, 1);
+   }
+}
+
+// Scrolls down the playlists a row every 25ms for half of each
+// second, and picks the last one it reaches.
+static void browse(unsigned long ms) {
+   if (ms % 1000 < 500 && ms % 25 == 0) {
+      sim::turn(1);
+   }
+   if (ms == STEADY_MS - 100) {
+      sim::set_pin(9, LOW);
+   }
+   if (ms == STEADY_MS - 50) {
+      sim::set_pin(9, HIGH);
+   }
+}
+
+static const Scenario scenarios[] = {
+   {"g_unpaired_screen", unpaired, 0},
+   {"home", paired, 0},
+   {"home (track changes)", paired, track_change},
+   {"home (trickled track changes)", paired, trickled_track_change},
+   {"home (framed track changes)", paired, framed_track_change},
+   {"home (wheel spin)", paired, wheel_spin},
+   {"home (button clicks)", paired, bouncy_click},
+   {"home (long presses)", paired, long_press},
+   {"home (skipping)", paired, skip_tracks},
+   {"home (skipping mid-title)", paired, skip_mid_title},
+   {"g_settings", settings, 0},
+   {"g_playlist_browser", playlists, browse},
+};
+
+static void run(unsigned long ms, Script during) {
+   for (unsigned long t = 0; t < ms * 1000; t += PASS_US) {
+      if (during && (t % 1000) == 0) {
+	 during(t / 1000);
+      }
+      loop();
+      phone.poll();
+      sim::advance_us(PASS_US);
+   }
+}
+
+static void report(const char *label, unsigned long frames) {
+   printf("  %-10s", label);
+   for (uint8_t i = 0; i < sim::N_PRIMITIVES; i++) {
+      if (sim::stats.calls[i]) {
+	 printf(" %s=%.1f", sim::primitive_names[i],
+		double(sim::stats.calls[i]) / frames);
+      }
+   }
+   printf("\n  %-10s pixels=%.1f flushed=%.1f commands=%.1f"
+	  " serial=%.1f ble_rx=%.1f ble_tx=%.1f ble_events=%.1f\n",
+	  "",
+	  double(sim::stats.pixels) / frames,
+	  double(sim::stats.flushed) / frames,
+	  double(sim::stats.commands) / frames,
+	  double(sim::stats.serial) / frames,
+	  double(sim::stats.ble_read) / frames,
+	  double(sim::stats.ble_packets) / frames,
+	  double(sim::stats.ble_events) / frames);
+}
+
+static void dump_panel() {
+   for (uint8_t y = 0; y < LCDHEIGHT; y++) {
+      printf("  |");
+      for (uint8_t x = 0; x < LCDWIDTH; x++) {
+	 uint8_t bank = sim::panel[(y / 8) * LCDWIDTH + x];
+	 putchar(bank & _BV(y % 8) ? '#' : ' ');
+      }
+      printf("|\n");
+   }
+}
+
+int main(int argc, char **argv) {
+   boolean dump = argc > 1 && !strcmp(argv[1], "-d");
+
+   setup();
+   sim::attach(&phone);
+
+   for (uint8_t i = 0; i < sizeof(scenarios) / sizeof(scenarios[0]); i++) {
+      const Scenario &s = scenarios[i];
+      unsigned long frames = STEADY_MS / FRAME_MS;
+
+      printf("%s\n", s.name);
+
+      s.enter();
+      sim::clear_stats();
+      run(FRAME_MS, 0);
+      report("first", 1);
+
+      unsigned long commands = phone.commands;
+      sim::clear_stats();
+      run(STEADY_MS, s.during);
+      report("per frame", frames);
+      printf("  %-10s commands=%lu volume=%d (shown as %d)\n", "phone",
+	     phone.commands - commands, phone.volume,
+	     g_volume.value().scale(255));
+
+      if (s.during == long_press) {
+	 printf("  %-10s liked before release: %lu\n", "", s_liked);
+      }
+      if (s.during == skip_mid_title) {
+	 printf("  %-10s titles torn by a skip: %lu\n", "", s_torn);
+      }
+      if (s.during == browse) {
+	 printf("  %-10s requests=%lu entries=%lu playing=%d\n", "",
+		phone.list_requests, phone.list_entries, phone.playlist);
+      }
+
+      if (s.during == skip_tracks) {
+	 printf("  %-10s first skip shown after %lu ms, then %.1f ms"
+		" on average (phone answers after %lu ms)\n", "",
+		s_first_skip_ms, double(s_skip_ms) / (s_skips - 1),
+		Phone::REPLY_MS);
+	 printf("  %-10s art chunks=%lu resent=%lu\n", "",
+		phone.art_chunks, phone.art_requests);
+      }
+
+      printf("  %-10s %s\n", "panel",
+	     memcmp(sim::panel, pcd8544_buffer, LCDWIDTH * LCDHEIGHT / 8) ?
+	     "STALE" : "in sync");
+      if (dump) {
+	 dump_panel();
+      }
+
+      if (s.enter == settings) {
+	 leave_settings();
+      } else if (s.enter == playlists) {
+	 // Picking a playlist closed the browser.
+	 leave_settings();
+      }
+   }
+
+   printf("events\n  %-10s high_water=%u dropped=%u\n", "queue",
+	  ui.high_water(), ui.dropped());
+#if LOG_LEVEL > LOG_LEVEL_NONE
+   printf("  %-10s dropped=%u\n", "log", g_log.dropped());
+#endif
+
+   return 0;
+}
@@ -0,0 +1,293 @@
+/* phone.h
+ *
+ * Stand-in for the phone at the other end of the BLE link. It
+ * understands the commands the remote sends, both the single
+ * character ones and binary frames (see Protocol.h), keeps its own
+ * idea of the player state, and answers the way the phone app does,
+ * using the text protocol.
+ *
+ * A skip takes the app REPLY_MS to answer, since it has to load the
+ * new track first. The answer also carries the tracks either side of
+ * the new one, in binary frames, and is followed by the track's album
+ * art, ART_CHUNK bytes at a time, each sent once the last is
+ * acknowledged. Requests for playlist names take LIST_REPLY_MS.
+ */
+
+#ifndef SIM_PHONE_H
+#define SIM_PHONE_H
+
+#include <stdio.h>
+
+#include "sim.h"
+
+class Phone : public sim::Peer {
+   public:
+      Phone() :
+	 volume(128),
+	 playing(false),
+	 commands(0),
+	 liked(0),
+	 playlist(-1),
+	 list_requests(0),
+	 list_entries(0),
+	 art_chunks(0),
+	 art_requests(0),
+	 m_track(0),
+	 m_skipped(false),
+	 m_listing(false) {
+      };
+
+      // Sends any answer which is due. Call every ms.
+      void poll() {
+	 if (m_skipped && millis() - m_skipped_at >= REPLY_MS) {
+	    m_skipped = false;
+	    track(m_track);
+	 }
+	 if (m_listing && millis() - m_listed_at >= LIST_REPLY_MS) {
+	    m_listing = false;
+	    list();
+	 }
+      };
+
+      void receive(const uint8_t *packet, uint8_t len) {
+	 boolean volume_changed = false;
+
+	 for (uint8_t i = 0; i < len; i++) {
+	    if (m_frames.active()) {
+	       if (m_frames.put(packet[i])) {
+		  commands++;
+		  frame();
+	       }
+	       continue;
+	    }
+
+	    commands++;
+	    switch (packet[i]) {
+	       case FRAME_START:
+		  commands--;
+		  m_frames.start();
+		  break;
+	       case 'V':
+		  volume = volume + VOLUME_STEP > 255 ?
+		     255 : volume + VOLUME_STEP;
+		  volume_changed = true;
+		  break;
+	       case 'v':
+		  volume = volume < VOLUME_STEP ? 0 : volume - VOLUME_STEP;
+		  volume_changed = true;
+		  break;
+	       case 'L':
+		  liked++;
+		  break;
+	       case 'x':
+		  playing = !playing;
+		  sim::ble_feed(playing ? "X" : "x");
+		  break;
+	       case 'N':
+		  skip(m_track + 1);
+		  break;
+	       case 'P':
+		  skip(m_track + TRACKS - 1);
+		  break;
+	    }
+	 }
+
+	 // The app reports the resulting volume once per packet of
+	 // single character commands...
+	 if (volume_changed) {
+	    report_volume();
+	 }
+      };
+
+      int volume;
+      boolean playing;
+      unsigned long commands;
+      unsigned long liked;     // 'L' commands received
+      int playlist;            // chosen with MSG_LIST_SELECT
+      unsigned long list_requests;
+      unsigned long list_entries;
+      unsigned long art_chunks;
+      unsigned long art_requests;  // MSG_ART_REQUEST received
+
+      static const unsigned long REPLY_MS = 300;
+      static const unsigned long LIST_REPLY_MS = 40;
+      static const uint16_t PLAYLISTS = 200;
+      static const uint8_t ART_SIZE = 24;
+      static const uint8_t ART_CHUNK = 20;
+
+   private:
+      static const int VOLUME_STEP = 8;
+      static const uint8_t TRACKS = 3;
+
+      void report_volume() {
+	 char msg[4];
+	 snprintf(msg, sizeof(msg), "v%02x", volume);
+	 sim::ble_feed(msg);
+      };
+
+      void frame() {
+	 switch (m_frames.type()) {
+	    case MSG_VOLUME_DELTA:
+	       // ...but acknowledges every relative change.
+	       if (m_frames.length() == 2) {
+		  uint8_t ack[2] = {m_frames.payload()[0]};
+
+		  volume += int8_t(m_frames.payload()[1]) * VOLUME_STEP;
+		  volume = constrain(volume, 0, 255);
+		  ack[1] = volume;
+		  send_frame(MSG_VOLUME_ACK, ack, sizeof(ack));
+	       }
+	       break;
+	    case MSG_LIST_REQUEST:
+	       if (m_frames.length() == 3) {
+		  const uint8_t *p = m_frames.payload();
+		  m_list_first = p[0] | p[1] << 8;
+		  m_list_count = p[2];
+		  m_listing = true;
+		  m_listed_at = millis();
+		  list_requests++;
+	       }
+	       break;
+	    case MSG_ART_ACK:
+	       send_art();
+	       break;
+	    case MSG_ART_REQUEST:
+	       art_requests++;
+	       start_art();
+	       break;
+	    case MSG_LIST_SELECT:
+	       if (m_frames.length() == 2) {
+		  playlist = m_frames.payload()[0] |
+		     m_frames.payload()[1] << 8;
+	       }
+	       break;
+	 }
+      };
+
+      void list() {
+	 uint8_t size[] = {PLAYLISTS & 0xff, PLAYLISTS >> 8};
+	 send_frame(MSG_LIST_SIZE, size, sizeof(size));
+
+	 for (uint16_t i = m_list_first;
+	      i < m_list_first + m_list_count && i < PLAYLISTS; i++) {
+	    uint8_t entry[16] = {(uint8_t) (i & 0xff), (uint8_t) (i >> 8)};
+	    int n = snprintf((char *) entry + 2, sizeof(entry) - 2,
+			     "Playlist %u", i + 1);
+	    send_frame(MSG_LIST_ENTRY, entry, 2 + n);
+	    list_entries++;
+	 }
+      };
+
+      void skip(uint8_t n) {
+	 m_track = n % TRACKS;
+	 m_skipped = true;
+	 m_skipped_at = millis();
+      };
+
+      void track(uint8_t n) {
+	 static const char *const tracks[TRACKS][2] = {
+	    {"Genesis", "Invisible Touch"},
+	    {"Peter Gabriel", "Sledgehammer"},
+	    {"Phil Collins", "In the Air Tonight"},
+	 };
+	 uint8_t next = (n + 1) % TRACKS;
+	 uint8_t prev = (n + TRACKS - 1) % TRACKS;
+
+	 sim::ble_feed("a");
+	 sim::ble_feed(tracks[n][0]);
+	 sim::ble_feed("\nt");
+	 sim::ble_feed(tracks[n][1]);
+	 sim::ble_feed("\n");
+
+	 send_frame(MSG_NEXT_ARTIST, tracks[next][0]);
+	 send_frame(MSG_NEXT_TRACK, tracks[next][1]);
+	 send_frame(MSG_PREV_ARTIST, tracks[prev][0]);
+	 send_frame(MSG_PREV_TRACK, tracks[prev][1]);
+
+	 encode_art(n);
+	 start_art();
+      };
+
+      // Each track's art is a different pattern, run-length encoded
+      // as StreamedImage expects.
+      static boolean art_pixel(uint8_t n, int x, int y) {
+	 int dx = x - ART_SIZE / 2, dy = y - ART_SIZE / 2;
+
+	 switch (n) {
+	    case 0:
+	       return dx * dx + dy * dy < 100;
+	    case 1:
+	       return (x + y) % 6 < 3;
+	    default:
+	       return (x / 4 + y / 4) % 2;
+	 }
+      };
+
+      void encode_art(uint8_t n) {
+	 int run = 0;
+	 boolean black = false;
+
+	 m_art_length = 0;
+	 for (int i = 0; i < ART_SIZE * ART_SIZE; i++) {
+	    boolean pixel = art_pixel(n, i % ART_SIZE, i / ART_SIZE);
+
+	    if (run && (pixel != black || run == 128)) {
+	       m_art[m_art_length++] = (black ? 0x80 : 0) | (run - 1);
+	       run = 0;
+	    }
+	    black = pixel;
+	    run++;
+	 }
+	 m_art[m_art_length++] = (black ? 0x80 : 0) | (run - 1);
+      };
+
+      void start_art() {
+	 uint8_t size[] = {ART_SIZE, ART_SIZE};
+
+	 send_frame(MSG_ART_START, size, sizeof(size));
+	 m_art_sent = 0;
+	 send_art();
+      };
+
+      void send_art() {
+	 uint8_t length = m_art_length - m_art_sent < ART_CHUNK ?
+	    m_art_length - m_art_sent : ART_CHUNK;
+
+	 if (length) {
+	    send_frame(MSG_ART_DATA, m_art + m_art_sent, length);
+	    m_art_sent += length;
+	    art_chunks++;
+	 }
+      };
+
+      void send_frame(uint8_t type, const char *str) {
+	 send_frame(type, (const uint8_t *) str, strlen(str));
+      };
+
+      void send_frame(uint8_t type, const uint8_t *payload, uint8_t length) {
+	 uint8_t header[] = {FRAME_START, type, length};
+	 uint8_t crc = crc8(crc8(0, type), length);
+
+	 for (uint8_t i = 0; i < length; i++) {
+	    crc = crc8(crc, payload[i]);
+	 }
+
+	 sim::ble_feed(header, sizeof(header));
+	 sim::ble_feed(payload, length);
+	 sim::ble_feed(&crc, 1);
+      };
+
+      uint8_t m_track;
+      boolean m_skipped;
+      unsigned long m_skipped_at;
+      boolean m_listing;
+      unsigned long m_listed_at;
+      uint16_t m_list_first;
+      uint8_t m_list_count;
+      uint8_t m_art[ART_SIZE * ART_SIZE];
+      uint16_t m_art_length;
+      uint16_t m_art_sent;
+      FrameDecoder<24> m_frames;
+};
+
+#endif
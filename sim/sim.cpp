@@ -0,0 +1,759 @@
+/* sim.cpp
+ *
+ * Implementation of the host stand-ins declared in stubs/ and of the
+ * harness interface in sim.h.
+ */
+
+#include <stdio.h>
+
+#include "Arduino.h"
+#include "Adafruit_GFX.h"
+#include "Adafruit_PCD8544.h"
+#include "AdaEncoder.h"
+#include "ooPinChangeInt.h"
+#include "RBL_nRF8001.h"
+
+#include "sim.h"
+#include "../Font5x7.h"
+
+namespace sim {
+
+const char *const primitive_names[N_PRIMITIVES] = {
+   "drawPixel",
+   "drawLine",
+   "drawFastVLine",
+   "drawFastHLine",
+   "drawRect",
+   "fillRect",
+   "fillScreen",
+   "drawTriangle",
+   "fillTriangle",
+   "drawBitmap",
+   "drawChar",
+};
+
+Stats stats;
+uint8_t panel[LCDWIDTH * LCDHEIGHT / 8];
+
+static unsigned long s_micros = 0;
+static int s_pins[64];
+static boolean s_pins_set[64];
+static CallBackInterface *s_handlers[64];
+static boolean s_echo = false;
+
+static boolean s_connected = false;
+static uint8_t s_rx[4096];
+static size_t s_rx_head = 0;
+static size_t s_rx_tail = 0;
+
+static const uint8_t MAX_PACKET = 20;
+static const uint8_t MAX_PACKETS = 64;
+static uint8_t s_tx[MAX_PACKETS][MAX_PACKET];
+static uint8_t s_tx_len[MAX_PACKETS];
+static uint8_t s_tx_count = 0;
+static Peer *s_peer = 0;
+
+void clear_stats() {
+   memset(&stats, 0, sizeof(stats));
+}
+
+void advance_us(unsigned long us) {
+   s_micros += us;
+}
+
+void advance(unsigned long ms) {
+   advance_us(ms * 1000UL);
+}
+
+void set_pin(uint8_t pin, int level) {
+   boolean changed = digitalRead(pin) != level;
+
+   s_pins[pin] = level;
+   s_pins_set[pin] = true;
+   if (changed && s_handlers[pin]) {
+      s_handlers[pin]->cbmPCInt(pin);
+   }
+}
+
+void turn(int8_t clicks) {
+   if (AdaEncoder::first()) {
+      AdaEncoder::first()->clicks += clicks;
+   }
+}
+
+void ble_connect(boolean connected) {
+   s_connected = connected;
+}
+
+void ble_feed(const uint8_t *data, size_t len) {
+   for (size_t i = 0; i < len; i++) {
+      s_rx[s_rx_tail] = data[i];
+      s_rx_tail = (s_rx_tail + 1) % sizeof(s_rx);
+   }
+}
+
+void ble_feed(const char *str) {
+   ble_feed((const uint8_t *) str, strlen(str));
+}
+
+size_t ble_pending() {
+   return (s_rx_tail + sizeof(s_rx) - s_rx_head) % sizeof(s_rx);
+}
+
+void attach(Peer *peer) {
+   s_peer = peer;
+}
+
+void echo_serial(boolean echo) {
+   s_echo = echo;
+}
+
+static void queue_packet(const uint8_t *data, uint8_t len) {
+   if (s_tx_count < MAX_PACKETS) {
+      memcpy(s_tx[s_tx_count], data, len);
+      s_tx_len[s_tx_count] = len;
+      s_tx_count++;
+   }
+}
+
+}
+
+
+/*
+ * Arduino core
+ */
+
+unsigned long millis() {
+   return sim::s_micros / 1000;
+}
+
+unsigned long micros() {
+   return sim::s_micros;
+}
+
+void delay(unsigned long ms) {
+   sim::advance(ms);
+}
+
+void pinMode(uint8_t pin, uint8_t mode) {}
+
+int digitalRead(uint8_t pin) {
+   return sim::s_pins_set[pin] ? sim::s_pins[pin] : HIGH;
+}
+
+void digitalWrite(uint8_t pin, uint8_t val) {}
+
+void noInterrupts() {}
+void interrupts() {}
+
+
+/*
+ * ooPinChangeInt
+ */
+
+int8_t PCintPort::attachInterrupt(uint8_t pin,
+				  CallBackInterface *handler,
+				  int mode) {
+   sim::s_handlers[pin] = handler;
+   return 0;
+}
+
+size_t Print::write(const uint8_t *buffer, size_t size) {
+   size_t n = 0;
+   while (size--) {
+      n += write(*buffer++);
+   }
+   return n;
+}
+
+size_t Print::write(const char *str) {
+   return write((const uint8_t *) str, strlen(str));
+}
+
+size_t Print::printNumber(unsigned long n, uint8_t base) {
+   char buf[8 * sizeof(long) + 1];
+   char *str = &buf[sizeof(buf) - 1];
+
+   *str = '\0';
+   do {
+      unsigned long m = n;
+      n /= base;
+      char c = m - base * n;
+      *--str = c < 10 ? c + '0' : c + 'A' - 10;
+   } while (n);
+
+   return write(str);
+}
+
+size_t Print::print(const __FlashStringHelper *str) {
+   return write((const char *) str);
+}
+
+size_t Print::print(const String &s) {
+   return write(s.c_str());
+}
+
+size_t Print::print(const char *str) {
+   return write(str);
+}
+
+size_t Print::print(char c) {
+   return write((uint8_t) c);
+}
+
+size_t Print::print(unsigned char n, int base) {
+   return printNumber(n, base);
+}
+
+size_t Print::print(int n, int base) {
+   return print((long) n, base);
+}
+
+size_t Print::print(unsigned int n, int base) {
+   return printNumber(n, base);
+}
+
+size_t Print::print(long n, int base) {
+   if (n < 0 && base == 10) {
+      return write('-') + printNumber(-n, base);
+   }
+   return printNumber(n, base);
+}
+
+size_t Print::print(unsigned long n, int base) {
+   return printNumber(n, base);
+}
+
+size_t Print::println(void) {
+   return write("\r\n");
+}
+
+#define PRINTLN(type)				\
+   size_t Print::println(type value) {		\
+      size_t n = print(value);			\
+      return n + println();			\
+   }
+
+#define PRINTLN_BASE(type)			\
+   size_t Print::println(type value, int base) {	\
+      size_t n = print(value, base);		\
+      return n + println();			\
+   }
+
+PRINTLN(const __FlashStringHelper *)
+PRINTLN(const String &)
+PRINTLN(const char *)
+PRINTLN(char)
+PRINTLN_BASE(unsigned char)
+PRINTLN_BASE(int)
+PRINTLN_BASE(unsigned int)
+PRINTLN_BASE(long)
+PRINTLN_BASE(unsigned long)
+
+String::String(const char *str) {
+   m_buffer[0] = 0;
+   *this += str;
+}
+
+String::String(unsigned long value) {
+   m_buffer[0] = 0;
+   *this += value;
+}
+
+String &String::operator+=(const char *str) {
+   strncat(m_buffer, str, sizeof(m_buffer) - strlen(m_buffer) - 1);
+   return *this;
+}
+
+String &String::operator+=(unsigned long value) {
+   char buf[12];
+   snprintf(buf, sizeof(buf), "%lu", value);
+   return *this += buf;
+}
+
+String operator+(const String &lhs, const char *rhs) {
+   String ret(lhs);
+   ret += rhs;
+   return ret;
+}
+
+String operator+(const String &lhs, unsigned long rhs) {
+   String ret(lhs);
+   ret += rhs;
+   return ret;
+}
+
+Serial_ Serial;
+
+int Serial_::available() {
+   return 0;
+}
+
+int Serial_::read() {
+   return -1;
+}
+
+// Models the 64 byte transmit buffer of a UART running at 9600 baud,
+// which sends a byte about every 1042us.
+static const unsigned long SERIAL_BYTE_US = 1042;
+static const unsigned long SERIAL_BUFFER = 64;
+static unsigned long s_serial_idle = 0;
+
+int Serial_::availableForWrite() {
+   unsigned long now = micros();
+   unsigned long queued = s_serial_idle > now ?
+      (s_serial_idle - now + SERIAL_BYTE_US - 1) / SERIAL_BYTE_US : 0;
+
+   return SERIAL_BUFFER - min(queued, SERIAL_BUFFER);
+}
+
+size_t Serial_::write(uint8_t c) {
+   s_serial_idle = max(s_serial_idle, micros()) + SERIAL_BYTE_US;
+   sim::stats.serial++;
+   if (sim::s_echo) {
+      putchar(c);
+   }
+   return 1;
+}
+
+
+/*
+ * Adafruit_GFX
+ */
+
+#define COUNT(primitive) (sim::stats.calls[sim::primitive]++)
+
+template <typename T> static void swap(T &a, T &b) {
+   T t = a;
+   a = b;
+   b = t;
+}
+
+Adafruit_GFX::Adafruit_GFX(int16_t w, int16_t h) :
+   WIDTH(w), HEIGHT(h)
+{
+   _width = WIDTH;
+   _height = HEIGHT;
+   rotation = 0;
+   cursor_y = cursor_x = 0;
+   textsize = 1;
+   textcolor = textbgcolor = 0xFFFF;
+   wrap = true;
+}
+
+void Adafruit_GFX::drawLine(int16_t x0, int16_t y0,
+			    int16_t x1, int16_t y1,
+			    uint16_t color) {
+   COUNT(DRAW_LINE);
+
+   int16_t steep = abs(y1 - y0) > abs(x1 - x0);
+   if (steep) {
+      swap(x0, y0);
+      swap(x1, y1);
+   }
+
+   if (x0 > x1) {
+      swap(x0, x1);
+      swap(y0, y1);
+   }
+
+   int16_t dx = x1 - x0;
+   int16_t dy = abs(y1 - y0);
+   int16_t err = dx / 2;
+   int16_t ystep = y0 < y1 ? 1 : -1;
+
+   for (; x0 <= x1; x0++) {
+      if (steep) {
+	 drawPixel(y0, x0, color);
+      } else {
+	 drawPixel(x0, y0, color);
+      }
+      err -= dy;
+      if (err < 0) {
+	 y0 += ystep;
+	 err += dx;
+      }
+   }
+}
+
+void Adafruit_GFX::drawFastVLine(int16_t x, int16_t y, int16_t h,
+				 uint16_t color) {
+   COUNT(DRAW_FAST_VLINE);
+   drawLine(x, y, x, y + h - 1, color);
+}
+
+void Adafruit_GFX::drawFastHLine(int16_t x, int16_t y, int16_t w,
+				 uint16_t color) {
+   COUNT(DRAW_FAST_HLINE);
+   drawLine(x, y, x + w - 1, y, color);
+}
+
+void Adafruit_GFX::drawRect(int16_t x, int16_t y, int16_t w, int16_t h,
+			    uint16_t color) {
+   COUNT(DRAW_RECT);
+   drawFastHLine(x, y, w, color);
+   drawFastHLine(x, y + h - 1, w, color);
+   drawFastVLine(x, y, h, color);
+   drawFastVLine(x + w - 1, y, h, color);
+}
+
+void Adafruit_GFX::fillRect(int16_t x, int16_t y, int16_t w, int16_t h,
+			    uint16_t color) {
+   COUNT(FILL_RECT);
+   for (int16_t i = x; i < x + w; i++) {
+      drawFastVLine(i, y, h, color);
+   }
+}
+
+void Adafruit_GFX::fillScreen(uint16_t color) {
+   COUNT(FILL_SCREEN);
+   fillRect(0, 0, _width, _height, color);
+}
+
+void Adafruit_GFX::invertDisplay(boolean i) {}
+
+void Adafruit_GFX::drawTriangle(int16_t x0, int16_t y0,
+				int16_t x1, int16_t y1,
+				int16_t x2, int16_t y2,
+				uint16_t color) {
+   COUNT(DRAW_TRIANGLE);
+   drawLine(x0, y0, x1, y1, color);
+   drawLine(x1, y1, x2, y2, color);
+   drawLine(x2, y2, x0, y0, color);
+}
+
+void Adafruit_GFX::fillTriangle(int16_t x0, int16_t y0,
+				int16_t x1, int16_t y1,
+				int16_t x2, int16_t y2,
+				uint16_t color) {
+   COUNT(FILL_TRIANGLE);
+
+   int16_t a, b, y, last;
+
+   if (y0 > y1) {
+      swap(y0, y1);
+      swap(x0, x1);
+   }
+   if (y1 > y2) {
+      swap(y2, y1);
+      swap(x2, x1);
+   }
+   if (y0 > y1) {
+      swap(y0, y1);
+      swap(x0, x1);
+   }
+
+   if (y0 == y2) {
+      a = b = x0;
+      if (x1 < a) {
+	 a = x1;
+      } else if (x1 > b) {
+	 b = x1;
+      }
+      if (x2 < a) {
+	 a = x2;
+      } else if (x2 > b) {
+	 b = x2;
+      }
+      drawFastHLine(a, y0, b - a + 1, color);
+      return;
+   }
+
+   int16_t
+      dx01 = x1 - x0,
+      dy01 = y1 - y0,
+      dx02 = x2 - x0,
+      dy02 = y2 - y0,
+      dx12 = x2 - x1,
+      dy12 = y2 - y1;
+   int32_t sa = 0, sb = 0;
+
+   last = (y1 == y2) ? y1 : y1 - 1;
+
+   for (y = y0; y <= last; y++) {
+      a = x0 + sa / dy01;
+      b = x0 + sb / dy02;
+      sa += dx01;
+      sb += dx02;
+      if (a > b) {
+	 swap(a, b);
+      }
+      drawFastHLine(a, y, b - a + 1, color);
+   }
+
+   sa = dx12 * (y - y1);
+   sb = dx02 * (y - y0);
+   for (; y <= y2; y++) {
+      a = x1 + sa / dy12;
+      b = x0 + sb / dy02;
+      sa += dx12;
+      sb += dx02;
+      if (a > b) {
+	 swap(a, b);
+      }
+      drawFastHLine(a, y, b - a + 1, color);
+   }
+}
+
+void Adafruit_GFX::drawBitmap(int16_t x, int16_t y,
+			      const uint8_t *bitmap,
+			      int16_t w, int16_t h,
+			      uint16_t color) {
+   COUNT(DRAW_BITMAP);
+
+   int16_t byte_width = (w + 7) / 8;
+
+   for (int16_t j = 0; j < h; j++) {
+      for (int16_t i = 0; i < w; i++) {
+	 if (pgm_read_byte(bitmap + j * byte_width + i / 8) &
+	     (128 >> (i & 7))) {
+	    drawPixel(x + i, y + j, color);
+	 }
+      }
+   }
+}
+
+void Adafruit_GFX::drawChar(int16_t x, int16_t y, unsigned char c,
+			    uint16_t color, uint16_t bg, uint8_t size) {
+   COUNT(DRAW_CHAR);
+
+   if ((x >= _width) ||
+       (y >= _height) ||
+       ((x + 6 * size - 1) < 0) ||
+       ((y + 8 * size - 1) < 0)) {
+      return;
+   }
+
+   const uint8_t *bitmap = glyph(c);
+
+   for (int8_t i = 0; i < 6; i++) {
+      uint8_t line = (i == 5) ? 0 : pgm_read_byte(bitmap + i);
+      for (int8_t j = 0; j < 8; j++) {
+	 if (line & 0x1) {
+	    if (size == 1) {
+	       drawPixel(x + i, y + j, color);
+	    } else {
+	       fillRect(x + (i * size), y + (j * size), size, size, color);
+	    }
+	 } else if (bg != color) {
+	    if (size == 1) {
+	       drawPixel(x + i, y + j, bg);
+	    } else {
+	       fillRect(x + i * size, y + j * size, size, size, bg);
+	    }
+	 }
+	 line >>= 1;
+      }
+   }
+}
+
+size_t Adafruit_GFX::write(uint8_t c) {
+   if (c == '\n') {
+      cursor_y += textsize * 8;
+      cursor_x = 0;
+   } else if (c == '\r') {
+      // skip
+   } else {
+      drawChar(cursor_x, cursor_y, c, textcolor, textbgcolor, textsize);
+      cursor_x += textsize * 6;
+      if (wrap && (cursor_x > (_width - textsize * 6))) {
+	 cursor_y += textsize * 8;
+	 cursor_x = 0;
+      }
+   }
+   return 1;
+}
+
+void Adafruit_GFX::setCursor(int16_t x, int16_t y) {
+   cursor_x = x;
+   cursor_y = y;
+}
+
+void Adafruit_GFX::setTextColor(uint16_t c) {
+   textcolor = textbgcolor = c;
+}
+
+void Adafruit_GFX::setTextColor(uint16_t c, uint16_t b) {
+   textcolor = c;
+   textbgcolor = b;
+}
+
+void Adafruit_GFX::setTextSize(uint8_t s) {
+   textsize = (s > 0) ? s : 1;
+}
+
+void Adafruit_GFX::setTextWrap(boolean w) {
+   wrap = w;
+}
+
+int16_t Adafruit_GFX::width(void) const {
+   return _width;
+}
+
+int16_t Adafruit_GFX::height(void) const {
+   return _height;
+}
+
+
+/*
+ * Adafruit_PCD8544
+ */
+
+uint8_t pcd8544_buffer[LCDWIDTH * LCDHEIGHT / 8];
+
+// The panel's own address counters, advanced as data is written.
+static uint8_t s_xaddr = 0;
+static uint8_t s_yaddr = 0;
+
+Adafruit_PCD8544::Adafruit_PCD8544(int8_t SCLK, int8_t DIN, int8_t DC,
+				   int8_t CS, int8_t RST) :
+   Adafruit_GFX(LCDWIDTH, LCDHEIGHT),
+   m_extended(false)
+{
+}
+
+void Adafruit_PCD8544::begin(uint8_t contrast, uint8_t bias) {
+   command(PCD8544_FUNCTIONSET | PCD8544_EXTENDEDINSTRUCTION);
+   command(PCD8544_SETBIAS | bias);
+   setContrast(contrast);
+   command(PCD8544_FUNCTIONSET);
+   command(PCD8544_DISPLAYCONTROL | PCD8544_DISPLAYNORMAL);
+   display();
+}
+
+void Adafruit_PCD8544::command(uint8_t c) {
+   sim::stats.commands++;
+
+   if ((c & 0xf8) == PCD8544_FUNCTIONSET) {
+      m_extended = c & PCD8544_EXTENDEDINSTRUCTION;
+   } else if (!m_extended && (c & PCD8544_SETXADDR)) {
+      s_xaddr = (c & 0x7f) % LCDWIDTH;
+   } else if (!m_extended && (c & 0xf8) == PCD8544_SETYADDR) {
+      s_yaddr = (c & 0x07) % (LCDHEIGHT / 8);
+   }
+}
+
+void Adafruit_PCD8544::data(uint8_t c) {
+   sim::stats.flushed++;
+
+   sim::panel[s_yaddr * LCDWIDTH + s_xaddr] = c;
+   if (++s_xaddr == LCDWIDTH) {
+      s_xaddr = 0;
+      s_yaddr = (s_yaddr + 1) % (LCDHEIGHT / 8);
+   }
+}
+
+void Adafruit_PCD8544::setContrast(uint8_t val) {
+   if (val > 0x7f) {
+      val = 0x7f;
+   }
+   command(PCD8544_FUNCTIONSET | PCD8544_EXTENDEDINSTRUCTION);
+   command(PCD8544_SETVOP | val);
+   command(PCD8544_FUNCTIONSET);
+}
+
+void Adafruit_PCD8544::clearDisplay(void) {
+   memset(pcd8544_buffer, 0, sizeof(pcd8544_buffer));
+   cursor_y = cursor_x = 0;
+}
+
+void Adafruit_PCD8544::display(void) {
+   for (uint8_t p = 0; p < LCDHEIGHT / 8; p++) {
+      command(PCD8544_SETYADDR | p);
+      command(PCD8544_SETXADDR | 0);
+      for (uint8_t col = 0; col < LCDWIDTH; col++) {
+	 data(pcd8544_buffer[(LCDWIDTH * p) + col]);
+      }
+   }
+   command(PCD8544_SETYADDR);
+}
+
+void Adafruit_PCD8544::drawPixel(int16_t x, int16_t y, uint16_t color) {
+   COUNT(DRAW_PIXEL);
+
+   if ((x < 0) || (x >= LCDWIDTH) || (y < 0) || (y >= LCDHEIGHT)) {
+      return;
+   }
+
+   sim::stats.pixels++;
+   if (color) {
+      pcd8544_buffer[x + (y / 8) * LCDWIDTH] |= _BV(y % 8);
+   } else {
+      pcd8544_buffer[x + (y / 8) * LCDWIDTH] &= ~_BV(y % 8);
+   }
+}
+
+uint8_t Adafruit_PCD8544::getPixel(int8_t x, int8_t y) {
+   if ((x < 0) || (x >= LCDWIDTH) || (y < 0) || (y >= LCDHEIGHT)) {
+      return 0;
+   }
+   return (pcd8544_buffer[x + (y / 8) * LCDWIDTH] >> (y % 8)) & 0x1;
+}
+
+
+/*
+ * AdaEncoder
+ */
+
+AdaEncoder *AdaEncoder::s_first = 0;
+
+AdaEncoder::AdaEncoder(char id, int8_t pinA, int8_t pinB) :
+   clicks(0)
+{
+   if (!s_first) {
+      s_first = this;
+   }
+}
+
+
+/*
+ * RBL_nRF8001
+ */
+
+void ble_begin() {}
+
+void ble_set_name(char *name) {}
+
+int ble_connected(void) {
+   return sim::s_connected;
+}
+
+int ble_available() {
+   return sim::ble_pending();
+}
+
+int ble_read() {
+   if (!sim::ble_pending()) {
+      return -1;
+   }
+
+   uint8_t c = sim::s_rx[sim::s_rx_head];
+   sim::s_rx_head = (sim::s_rx_head + 1) % sizeof(sim::s_rx);
+   sim::stats.ble_read++;
+   return c;
+}
+
+void ble_write(unsigned char data) {
+   sim::queue_packet(&data, 1);
+}
+
+void ble_write_bytes(unsigned char *data, unsigned char len) {
+   while (len) {
+      uint8_t n = len > sim::MAX_PACKET ? sim::MAX_PACKET : len;
+      sim::queue_packet(data, n);
+      data += n;
+      len -= n;
+   }
+}
+
+void ble_do_events() {
+   sim::stats.ble_events++;
+   for (uint8_t i = 0; i < sim::s_tx_count; i++) {
+      sim::stats.ble_packets++;
+      sim::stats.ble_bytes += sim::s_tx_len[i];
+      if (sim::s_peer) {
+	 sim::s_peer->receive(sim::s_tx[i], sim::s_tx_len[i]);
+      }
+   }
+   sim::s_tx_count = 0;
+}
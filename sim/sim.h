@@ -0,0 +1,98 @@
+/* sim.h
+ *
+ * Harness interface to the host simulation. The stubs in stubs/ stand
+ * in for the Arduino core and the libraries the sketch depends on;
+ * this header is how a driver such as bench.cpp controls them and
+ * reads back what the firmware did.
+ */
+
+#ifndef SIM_H
+#define SIM_H
+
+#include "Arduino.h"
+
+namespace sim {
+
+/*
+ * Drawing primitives, as counted by the Adafruit_GFX stub. Nested
+ * calls are counted too: a fillRect() is also a number of
+ * drawFastVLine() calls, just as it is on the device.
+ */
+typedef enum {
+   DRAW_PIXEL,
+   DRAW_LINE,
+   DRAW_FAST_VLINE,
+   DRAW_FAST_HLINE,
+   DRAW_RECT,
+   FILL_RECT,
+   FILL_SCREEN,
+   DRAW_TRIANGLE,
+   FILL_TRIANGLE,
+   DRAW_BITMAP,
+   DRAW_CHAR,
+   N_PRIMITIVES
+} Primitive;
+
+extern const char *const primitive_names[N_PRIMITIVES];
+
+struct Stats {
+   unsigned long calls[N_PRIMITIVES];
+   unsigned long pixels;      // pixels written with drawPixel()
+   unsigned long flushed;     // data bytes sent to the panel
+   unsigned long commands;    // command bytes sent to the panel
+   unsigned long serial;      // bytes written to Serial
+   unsigned long ble_packets; // radio transactions sent to the phone
+   unsigned long ble_bytes;   // payload bytes sent to the phone
+   unsigned long ble_read;    // bytes received from the phone
+   unsigned long ble_events;  // calls to ble_do_events()
+};
+
+extern Stats stats;
+
+void clear_stats();
+
+/*
+ * The virtual clock. It only moves when the harness moves it.
+ */
+void advance_us(unsigned long us);
+void advance(unsigned long ms);
+
+/*
+ * Inputs. Pins float high (as with INPUT_PULLUP) until set. If a
+ * pin-change handler is attached to the pin, set_pin() calls it
+ * whenever the level changes.
+ */
+void set_pin(uint8_t pin, int level);
+void turn(int8_t clicks);
+
+/*
+ * The BLE link. Bytes fed with ble_feed() are returned by
+ * ble_read() in order. Packets the firmware sends are handed to the
+ * attached Peer, if any, when it calls ble_do_events().
+ */
+class Peer {
+   public:
+      virtual ~Peer() {};
+      virtual void receive(const uint8_t *packet, uint8_t len) = 0;
+};
+
+void ble_connect(boolean connected);
+void ble_feed(const uint8_t *data, size_t len);
+void ble_feed(const char *str);
+size_t ble_pending();
+void attach(Peer *peer);
+
+/*
+ * Echo Serial output to stdout, rather than just counting it.
+ */
+void echo_serial(boolean echo);
+
+/*
+ * What the panel is currently showing, i.e. the bytes which have
+ * actually been flushed to it, in the same layout as pcd8544_buffer.
+ */
+extern uint8_t panel[];
+
+}
+
+#endif
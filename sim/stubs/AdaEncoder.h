@@ -0,0 +1,37 @@
+/* AdaEncoder.h
+ *
+ * Host stand-in for AdaEncoder. The harness turns the wheel with
+ * sim::turn(), which accumulates clicks on the most recently
+ * constructed encoder.
+ */
+
+#ifndef __ADAENCODER_H__
+#define __ADAENCODER_H__
+
+#include "Arduino.h"
+
+class AdaEncoder {
+   public:
+      AdaEncoder(char id, int8_t pinA, int8_t pinB);
+
+      int8_t getClicks() {
+	 return clicks;
+      };
+
+      int8_t query() {
+	 int8_t ret = clicks;
+	 clicks = 0;
+	 return ret;
+      };
+
+      static AdaEncoder *first() {
+	 return s_first;
+      };
+
+      volatile int8_t clicks;
+
+   private:
+      static AdaEncoder *s_first;
+};
+
+#endif
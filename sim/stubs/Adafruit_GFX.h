@@ -0,0 +1,63 @@
+/* Adafruit_GFX.h
+ *
+ * Host stand-in for Adafruit_GFX. The interface matches the library
+ * version the firmware is built against, and the primitives use the
+ * same decomposition as the library (lines into pixels, rects into
+ * vertical lines and so on), so that call and pixel counts reflect
+ * what the device actually does. Every primitive reports itself to
+ * sim::stats.
+ */
+
+#ifndef _ADAFRUIT_GFX_H
+#define _ADAFRUIT_GFX_H
+
+#include "Arduino.h"
+
+class Adafruit_GFX : public Print {
+   public:
+      Adafruit_GFX(int16_t w, int16_t h);
+
+      virtual void drawPixel(int16_t x, int16_t y, uint16_t color) = 0;
+
+      virtual void
+	 drawLine(int16_t x0, int16_t y0, int16_t x1, int16_t y1,
+		  uint16_t color),
+	 drawFastVLine(int16_t x, int16_t y, int16_t h, uint16_t color),
+	 drawFastHLine(int16_t x, int16_t y, int16_t w, uint16_t color),
+	 drawRect(int16_t x, int16_t y, int16_t w, int16_t h,
+		  uint16_t color),
+	 fillRect(int16_t x, int16_t y, int16_t w, int16_t h,
+		  uint16_t color),
+	 fillScreen(uint16_t color),
+	 invertDisplay(boolean i);
+
+      void
+	 drawTriangle(int16_t x0, int16_t y0, int16_t x1, int16_t y1,
+		      int16_t x2, int16_t y2, uint16_t color),
+	 fillTriangle(int16_t x0, int16_t y0, int16_t x1, int16_t y1,
+		      int16_t x2, int16_t y2, uint16_t color),
+	 drawBitmap(int16_t x, int16_t y, const uint8_t *bitmap,
+		    int16_t w, int16_t h, uint16_t color),
+	 drawChar(int16_t x, int16_t y, unsigned char c, uint16_t color,
+		  uint16_t bg, uint8_t size),
+	 setCursor(int16_t x, int16_t y),
+	 setTextColor(uint16_t c),
+	 setTextColor(uint16_t c, uint16_t bg),
+	 setTextSize(uint8_t s),
+	 setTextWrap(boolean w);
+
+      virtual size_t write(uint8_t);
+      using Print::write;
+
+      int16_t width(void) const;
+      int16_t height(void) const;
+
+   protected:
+      const int16_t WIDTH, HEIGHT;
+      int16_t _width, _height, cursor_x, cursor_y;
+      uint16_t textcolor, textbgcolor;
+      uint8_t textsize, rotation;
+      boolean wrap;
+};
+
+#endif
@@ -0,0 +1,156 @@
+/* Arduino.h
+ *
+ * Host stand-in for the parts of the Arduino core which the sketch
+ * uses. Time is a virtual clock which only moves when the harness
+ * advances it (see sim.h), pins read whatever the harness sets, and
+ * Serial output is counted rather than transmitted.
+ */
+
+#ifndef Arduino_h
+#define Arduino_h
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <stddef.h>
+#include <string.h>
+
+#include "binary.h"
+
+typedef bool boolean;
+typedef uint8_t byte;
+
+#define HIGH 0x1
+#define LOW  0x0
+
+#define INPUT        0x0
+#define OUTPUT       0x1
+#define INPUT_PULLUP 0x2
+
+#define CHANGE 1
+#define FALLING 2
+#define RISING 3
+
+#define DEC 10
+#define HEX 16
+
+#define PROGMEM
+#define PGM_P const char *
+#define PSTR(s) (s)
+#define pgm_read_byte(addr) (*(const uint8_t *)(addr))
+#define pgm_read_word(addr) (*(const uint16_t *)(addr))
+#define pgm_read_ptr(addr) (*(void * const *)(addr))
+#define strlen_P strlen
+#define memcpy_P memcpy
+#define strncpy_P strncpy
+
+#define _BV(bit) (1 << (bit))
+
+#define min(a,b) ((a)<(b)?(a):(b))
+#define max(a,b) ((a)>(b)?(a):(b))
+#define constrain(amt,low,high) \
+   ((amt)<(low)?(low):((amt)>(high)?(high):(amt)))
+
+class __FlashStringHelper;
+#define F(string_literal) \
+   (reinterpret_cast<const __FlashStringHelper *>(PSTR(string_literal)))
+
+unsigned long millis();
+unsigned long micros();
+void delay(unsigned long ms);
+
+void pinMode(uint8_t pin, uint8_t mode);
+int digitalRead(uint8_t pin);
+void digitalWrite(uint8_t pin, uint8_t val);
+
+void noInterrupts();
+void interrupts();
+
+class String;
+
+/*
+ * Just enough of Print to support the sketch and the GFX stubs.
+ */
+class Print {
+   public:
+      virtual ~Print() {};
+      virtual size_t write(uint8_t) = 0;
+      virtual size_t write(const uint8_t *buffer, size_t size);
+      size_t write(const char *str);
+      virtual int availableForWrite() {
+	 return 0;
+      };
+
+      size_t print(const __FlashStringHelper *);
+      size_t print(const String &);
+      size_t print(const char *);
+      size_t print(char);
+      size_t print(unsigned char, int = DEC);
+      size_t print(int, int = DEC);
+      size_t print(unsigned int, int = DEC);
+      size_t print(long, int = DEC);
+      size_t print(unsigned long, int = DEC);
+
+      size_t println(const __FlashStringHelper *);
+      size_t println(const String &);
+      size_t println(const char *);
+      size_t println(char);
+      size_t println(unsigned char, int = DEC);
+      size_t println(int, int = DEC);
+      size_t println(unsigned int, int = DEC);
+      size_t println(long, int = DEC);
+      size_t println(unsigned long, int = DEC);
+      size_t println(void);
+
+   private:
+      size_t printNumber(unsigned long, uint8_t);
+};
+
+/*
+ * Fixed-capacity String, sufficient for TestScreen.
+ */
+class String {
+   public:
+      String(const char *str = "");
+      String(unsigned long value);
+
+      String &operator+=(const char *str);
+      String &operator+=(unsigned long value);
+
+      const char *c_str() const {
+	 return m_buffer;
+      };
+
+   private:
+      char m_buffer[48];
+};
+
+String operator+(const String &lhs, const char *rhs);
+String operator+(const String &lhs, unsigned long rhs);
+
+class Stream : public Print {
+   public:
+      virtual int available() = 0;
+      virtual int read() = 0;
+};
+
+/*
+ * On the ATmega32U4 Serial is the USB CDC port, a Serial_ rather
+ * than a HardwareSerial, so code which takes Serial has to work with
+ * a Stream or Print.
+ */
+class Serial_ : public Stream {
+   public:
+      void begin(unsigned long baud) {};
+      int available();
+      int read();
+      int availableForWrite();
+      size_t write(uint8_t c);
+      using Print::write;
+      operator bool() {
+	 return true;
+      };
+};
+
+extern Serial_ Serial;
+
+#endif
@@ -0,0 +1,24 @@
+/* RBL_nRF8001.h
+ *
+ * Host stand-in for the Red Bear Labs BLE serial emulation. Incoming
+ * data is a byte stream scripted by the harness (sim::ble_feed()).
+ * Outgoing writes are queued as one radio transaction per call, the
+ * way the vendor library issues them, and are delivered to the phone
+ * stand-in by ble_do_events().
+ */
+
+#ifndef _RBL_NRF8001_H
+#define _RBL_NRF8001_H
+
+#include "Arduino.h"
+
+void ble_begin();
+void ble_set_name(char *name);
+int ble_connected(void);
+int ble_available();
+int ble_read();
+void ble_write(unsigned char data);
+void ble_write_bytes(unsigned char *data, unsigned char len);
+void ble_do_events();
+
+#endif
@@ -0,0 +1,6 @@
+/* SPI.h - empty host stand-in; the PCD8544 stub does not use SPI. */
+
+#ifndef _SPI_H_INCLUDED
+#define _SPI_H_INCLUDED
+
+#endif
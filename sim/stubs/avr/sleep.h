@@ -0,0 +1,19 @@
+/* avr/sleep.h - host stand-in for the avr-libc sleep functions.
+ *
+ * On the host there's nothing to wait for: the harness advances the
+ * virtual clock between passes of loop(), so sleeping returns at
+ * once.
+ */
+
+#ifndef _AVR_SLEEP_H_
+#define _AVR_SLEEP_H_
+
+#define SLEEP_MODE_IDLE 0
+
+#define set_sleep_mode(mode) do {} while (0)
+#define sleep_enable() do {} while (0)
+#define sleep_disable() do {} while (0)
+#define sleep_cpu() do {} while (0)
+#define sleep_mode() do {} while (0)
+
+#endif
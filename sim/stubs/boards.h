@@ -0,0 +1,6 @@
+/* boards.h - empty host stand-in for the Red Bear Labs board header. */
+
+#ifndef _BOARDS_H_
+#define _BOARDS_H_
+
+#endif
@@ -0,0 +1,26 @@
+/* ooPinChangeInt.h
+ *
+ * Host stand-in for ooPinChangeInt. sim::set_pin() calls the
+ * attached handler synchronously whenever it changes the level of a
+ * pin, as the interrupt would.
+ */
+
+#ifndef ooPinChangeInt_h
+#define ooPinChangeInt_h
+
+#include "Arduino.h"
+
+class CallBackInterface {
+   public:
+      CallBackInterface() {};
+      virtual void cbmPCInt(int8_t id) {};
+};
+
+class PCintPort {
+   public:
+      static int8_t attachInterrupt(uint8_t pin,
+				    CallBackInterface *handler,
+				    int mode);
+};
+
+#endif